@@ -0,0 +1,90 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <span>
+#include <string>
+#include "lampactivity.hpp"
+
+// How brightly each lamp of a stream glows: the fraction of the samples in a display frame in which its
+// bit was lit, as a real lamp integrates what it is driven with. Bits that toggle faster than the
+// display refreshes show dimmed rather than on or off.
+//
+// The samples of a frame are counted with vertical counters: plane k holds bit k of the count of every
+// lamp in a register, so adding a sample is a ripple-carry addition of the register to all 64 counters
+// at once, a few word operations whatever the number of lamps. The counts are only taken apart per
+// lamp once per frame.
+class Afterglow
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    static constexpr auto frame = std::chrono::microseconds(1000000 / 60);     // one display refresh
+    static constexpr int planes = 8;
+    static constexpr uint32_t max_samples = (1u << planes) - 1;                // per frame, so counts fit
+    static constexpr unsigned levels = 16;                                      // one hex digit per lamp
+
+    void add(const PanelLamps& lamps, std::span<const LampRegister> registers, clock::time_point now)
+    {
+        if (samples > 0 && (now - frame_start >= frame || samples == max_samples))
+            finish_frame(registers);
+        if (samples == 0)
+            frame_start = now;
+
+        for (size_t i = 0; i < registers.size() && i < PanelLamps::max_words; i++)
+        {
+            uint64_t carry = lamps.words[i];
+            for (int k = 0; k < planes && carry; k++)
+            {
+                uint64_t next = counters[i][k] & carry;
+                counters[i][k] ^= carry;
+                carry = next;
+            }
+        }
+        samples++;
+    }
+
+    // Before the first frame is finished there is nothing to show
+    bool empty() const { return glow.empty(); }
+
+    // Adds "glow":{"<name>":"<levels>",...} of the last finished frame to a state object, with a hex digit
+    // from 0 (dark) to f (fully lit) per lamp, the most significant bit first
+    std::string attach(const std::string& json) const
+    {
+        if (glow.empty() || json.size() < 2 || json.back() != '}')
+            return json;
+
+        return json.substr(0, json.size() - 1) + glow + '}';
+    }
+
+private:
+    void finish_frame(std::span<const LampRegister> registers)
+    {
+        glow = ",\"glow\":{";
+        for (size_t i = 0; i < registers.size() && i < PanelLamps::max_words; i++)
+        {
+            if (i > 0)
+                glow += ',';
+            glow += '"';
+            glow += registers[i].name;
+            glow += "\":\"";
+            for (int bit = int(registers[i].bits) - 1; bit >= 0; bit--)
+            {
+                uint32_t count = 0;
+                for (int k = 0; k < planes; k++)
+                    count |= uint32_t((counters[i][k] >> bit) & 1) << k;
+                glow += "0123456789abcdef"[(count * (levels - 1) + samples / 2) / samples];
+            }
+            glow += '"';
+        }
+        glow += '}';
+
+        counters = {};
+        samples = 0;
+    }
+
+    std::array<std::array<uint64_t, planes>, PanelLamps::max_words> counters{};
+    uint32_t samples = 0;
+    clock::time_point frame_start;
+    std::string glow;               // of the last finished frame
+};
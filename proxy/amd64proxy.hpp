@@ -6,6 +6,7 @@ class AMD64Proxy : public ProxyBase
 public:
     AMD64Proxy(unsigned short port);
     ~AMD64Proxy() override = default;
-    std::string udp_packet_to_json(std::span<const char> data) override;
+    std::string panel_state_to_json(std::span<const char> data) override;
+    panel_type handled_type() const override { return PANEL_NETBSDX64; }
     const char* module_name() const override { return "AMD64Proxy"; }
 };
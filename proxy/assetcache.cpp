@@ -0,0 +1,249 @@
+#include "assetcache.hpp"
+#include <poll.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <utility>
+#include <vector>
+#define CROW_ENABLE_COMPRESSION 1
+#include "crow_all.h"
+
+#ifdef __linux__
+#include <sys/inotify.h>
+
+// Everything that changes which files there are or what they contain
+constexpr uint32_t WATCH_EVENTS = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
+#endif
+
+namespace fs = std::filesystem;
+
+AssetCache::AssetCache(std::string content_dir, std::span<const EmbeddedAsset> embedded)
+    : content_dir(std::move(content_dir))
+    , embedded(embedded)
+{
+}
+
+AssetCache::~AssetCache()
+{
+    stop();
+}
+
+void AssetCache::start()
+{
+#ifdef __linux__
+    if (!content_dir.empty())
+    {
+        inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotify_fd < 0)
+            log_error("Cannot watch '%s' for changes: %s", content_dir.c_str(), strerror(errno));
+    }
+#endif
+
+    load();
+
+    if (inotify_fd >= 0)
+        watcher = std::thread([&]() { watch_loop(); });
+}
+
+void AssetCache::stop()
+{
+    stop_requested.store(true);
+    if (watcher.joinable())
+        watcher.join();
+
+    if (inotify_fd >= 0)
+    {
+        close(inotify_fd);
+        inotify_fd = -1;
+    }
+}
+
+std::shared_ptr<const AssetCache::Asset> AssetCache::find(std::string path) const
+{
+    if (path.empty() || path.back() == '/')
+        path += "index.html";
+
+    std::shared_ptr<const AssetMap> current;
+    {
+        std::lock_guard guard(mutex);
+        current = assets;
+    }
+
+    // Only files that were loaded can be found, so paths such as ../ cannot escape the directory
+    auto it = current->find(path);
+    return it != current->end() ? it->second : nullptr;
+}
+
+std::shared_ptr<const AssetCache::Asset> AssetCache::make_asset(const std::string& path, std::string body)
+{
+    auto asset = std::make_shared<Asset>();
+
+    size_t dot = path.rfind('.');
+    auto type = dot == std::string::npos ? crow::mime_types.end() : crow::mime_types.find(path.substr(dot + 1));
+    asset->content_type = type != crow::mime_types.end() ? type->second : "application/octet-stream";
+
+    // FNV-1a over the contents; the length is included as well, to make collisions even less likely
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (unsigned char c : body)
+    {
+        hash ^= c;
+        hash *= 0x100000001b3ULL;
+    }
+    char etag[48];
+    snprintf(etag, sizeof(etag), "\"%zx-%016llx\"", body.size(), (unsigned long long)hash);
+    asset->etag = etag;
+
+    // A gzip stream (window bits 15 + 16), kept only if it saves at least a tenth, which leaves out images
+    z_stream stream{};
+    if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) == Z_OK)
+    {
+        std::string gzip(deflateBound(&stream, uLong(body.size())), '\0');
+        stream.next_in = reinterpret_cast<Bytef*>(body.data());
+        stream.avail_in = uInt(body.size());
+        stream.next_out = reinterpret_cast<Bytef*>(gzip.data());
+        stream.avail_out = uInt(gzip.size());
+        if (deflate(&stream, Z_FINISH) == Z_STREAM_END && stream.total_out < body.size() - body.size() / 10)
+            gzip.resize(stream.total_out);
+        else
+            gzip.clear();
+        deflateEnd(&stream);
+
+        // One buffer for both, which is not moved after the views are taken
+        asset->storage = std::move(body);
+        asset->storage += gzip;
+        asset->body = std::string_view(asset->storage).substr(0, asset->storage.size() - gzip.size());
+        asset->gzip = std::string_view(asset->storage).substr(asset->body.size());
+    }
+    else
+    {
+        asset->storage = std::move(body);
+        asset->body = asset->storage;
+    }
+
+    return asset;
+}
+
+void AssetCache::load()
+{
+    if (content_dir.empty())
+        load_embedded();
+    else
+        load_directory();
+}
+
+void AssetCache::load_embedded()
+{
+    auto loaded = std::make_shared<AssetMap>();
+    for (const auto& file : embedded)
+    {
+        auto asset = std::make_shared<Asset>();
+        asset->content_type = file.content_type;
+        asset->etag = file.etag;
+        asset->body = std::string_view(reinterpret_cast<const char*>(file.body), file.body_size);
+        if (file.gzip)
+            asset->gzip = std::string_view(reinterpret_cast<const char*>(file.gzip), file.gzip_size);
+        (*loaded)[file.path] = std::move(asset);
+    }
+
+    log_info("Serving %zu built-in files", loaded->size());
+
+    std::lock_guard guard(mutex);
+    assets = std::move(loaded);
+}
+
+void AssetCache::load_directory()
+{
+    auto loaded = std::make_shared<AssetMap>();
+    size_t bytes = 0, gzip_bytes = 0;
+
+    std::error_code error;
+    fs::recursive_directory_iterator it(content_dir, fs::directory_options::follow_directory_symlink, error);
+    if (error)
+        log_error("Cannot read '%s': %s", content_dir.c_str(), error.message().c_str());
+
+#ifdef __linux__
+    if (inotify_fd >= 0)
+        inotify_add_watch(inotify_fd, content_dir.c_str(), WATCH_EVENTS);
+#endif
+
+    for (; !error && it != fs::recursive_directory_iterator(); it.increment(error))
+    {
+        // Leave out hidden files, such as the swap files of editors, and hidden directories
+        std::string name = it->path().filename().string();
+        if (!name.empty() && name[0] == '.')
+        {
+            if (it->is_directory())
+                it.disable_recursion_pending();
+            continue;
+        }
+
+        if (it->is_directory())
+        {
+#ifdef __linux__
+            // inotify does not watch subdirectories, so each one gets its own watch
+            if (inotify_fd >= 0)
+                inotify_add_watch(inotify_fd, it->path().c_str(), WATCH_EVENTS);
+#endif
+            continue;
+        }
+
+        if (!it->is_regular_file())
+            continue;
+
+        std::string path = it->path().lexically_relative(content_dir).generic_string();
+        std::error_code size_error;
+        if (it->file_size(size_error) > max_file_size && !size_error)
+        {
+            log_error("Not serving %s, which is larger than %zu bytes", path.c_str(), max_file_size);
+            continue;
+        }
+
+        std::ifstream file(it->path(), std::ios::binary);
+        std::string body((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        if (!file)
+        {
+            log_error("Cannot read %s", it->path().c_str());
+            continue;
+        }
+
+        auto asset = make_asset(path, std::move(body));
+        bytes += asset->body.size();
+        gzip_bytes += asset->gzip.empty() ? asset->body.size() : asset->gzip.size();
+        (*loaded)[path] = std::move(asset);
+    }
+
+    log_info("Loaded %zu files from '%s': %zu bytes, %zu with gzip", loaded->size(), content_dir.c_str(),
+            bytes, gzip_bytes);
+
+    std::lock_guard guard(mutex);
+    assets = std::move(loaded);
+}
+
+void AssetCache::watch_loop()
+{
+#ifdef __linux__
+    std::vector<char> buffer(64 * 1024);
+    while (!stop_requested.load())
+    {
+        pollfd pfd{inotify_fd, POLLIN, 0};
+        if (poll(&pfd, 1, 100) <= 0)
+            continue;
+
+        // Let a burst of changes, such as a checkout or an editor saving, settle before reloading once.
+        // The events themselves do not matter, as everything is reloaded.
+        do
+        {
+            while (read(inotify_fd, buffer.data(), buffer.size()) > 0)
+                ;
+            pfd.revents = 0;
+        } while (!stop_requested.load() && poll(&pfd, 1, int(settle_time.count())) > 0);
+
+        if (!stop_requested.load())
+            load_directory();
+    }
+#endif
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include "logging.hpp"
+#include "webcontent.hpp"
+
+// The static web content, held in memory so that requests are served without touching the disk.
+// Every file has a strong ETag and, if it compresses, a gzip copy. By default the content is the copy of
+// wwwroot compiled into udproxy, which is served straight from the binary. For development, a directory
+// can be served instead: it is read at startup into an immutable map that is replaced as a whole when a
+// file changes; on Linux the directory is watched with inotify, elsewhere changes take effect when
+// udproxy is restarted.
+class AssetCache : public Loggable
+{
+public:
+    struct Asset
+    {
+        std::string content_type;
+        std::string etag;           // quoted, as sent in the ETag header
+        std::string_view body;
+        std::string_view gzip;      // empty if compression does not make the body smaller
+        std::string storage;        // body and gzip of a file read from disk
+    };
+
+    // Serves content_dir, or the embedded files if it is empty
+    AssetCache(std::string content_dir, std::span<const EmbeddedAsset> embedded);
+    ~AssetCache();
+    const char* module_name() const override { return "AssetCache"; }
+
+    // Loads the content and starts watching the content directory for changes
+    void start();
+    void stop();
+
+    // Reads the content directory, or takes the embedded files, without watching for changes
+    void load();
+
+    // The file at path relative to the content directory; a directory path gives its index.html
+    std::shared_ptr<const Asset> find(std::string path) const;
+
+    // An asset with the body given, its content type taken from the extension of path
+    static std::shared_ptr<const Asset> make_asset(const std::string& path, std::string body);
+
+    // Calls f(path, asset) for every file, in no particular order
+    template<typename F>
+    void for_each(F f) const
+    {
+        std::shared_ptr<const AssetMap> current;
+        {
+            std::lock_guard guard(mutex);
+            current = assets;
+        }
+        for (const auto& [path, asset] : *current)
+            f(path, *asset);
+    }
+
+private:
+    using AssetMap = std::unordered_map<std::string, std::shared_ptr<const Asset>>;
+
+    static constexpr size_t max_file_size = 16 * 1024 * 1024;
+    static constexpr auto settle_time = std::chrono::milliseconds(100);    // for editors that write in steps
+
+    void load_directory();
+    void load_embedded();
+    void watch_loop();
+
+    std::string content_dir;
+    std::span<const EmbeddedAsset> embedded;
+    int inotify_fd = -1;
+    std::thread watcher;
+    std::atomic<bool> stop_requested{false};
+
+    mutable std::mutex mutex;           // guards assets
+    std::shared_ptr<const AssetMap> assets = std::make_shared<AssetMap>();
+};
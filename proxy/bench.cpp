@@ -0,0 +1,344 @@
+// bench.cpp - Microbenchmarks for the decode/encode hot paths of the proxies
+//
+// Feeds canned datagrams to the proxies' UDP-to-JSON conversion and to the ProxyBase helpers it is
+// built on. Besides time per frame, every benchmark reports heap allocations and allocated bytes
+// per frame, counted by the replacement operator new below. Run with `make bench`.
+
+#include "pdproxy.hpp"
+#include "amd64proxy.hpp"
+#include "netbsdvaxproxy.hpp"
+#include <benchmark/benchmark.h>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+
+namespace
+{
+    uint64_t allocation_count = 0;
+    uint64_t allocation_bytes = 0;
+}
+
+// GCC cannot tell that the replacement operators below pair malloc() with free()
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(size_t size)
+{
+    allocation_count++;
+    allocation_bytes += size;
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+namespace
+{
+    // Exposes the protected ProxyBase helpers of a proxy
+    template<typename Proxy>
+    class Exposed : public Proxy
+    {
+    public:
+        using Proxy::Proxy;
+        using Proxy::parse_packet;
+        using Proxy::packet;
+        using Proxy::get_panel_state;
+        using Proxy::to_hex;
+    };
+
+    class NullProxy : public ProxyBase
+    {
+    public:
+        NullProxy() : ProxyBase(0) {}
+        std::string panel_state_to_json(std::span<const char>) override { return {}; }
+        panel_type handled_type() const override { return PANEL_PDP1170; }
+        const char* module_name() const override { return "BenchProxy"; }
+    };
+
+    using BenchProxy = Exposed<NullProxy>;
+
+    template<typename T>
+    std::vector<char> make_datagram(panel_type type, const T& panel_state)
+    {
+        panel_packet_header header;
+        header.pp_byte_count = sizeof(T);
+        header.pp_byte_flags = type;
+
+        std::vector<char> datagram(sizeof(header) + sizeof(T));
+        memcpy(datagram.data(), &header, sizeof(header));
+        memcpy(datagram.data() + sizeof(header), &panel_state, sizeof(T));
+        return datagram;
+    }
+
+    template<typename T>
+    std::vector<char> make_datagram_v2(panel_type type, const T& panel_state)
+    {
+        panel_packet_header_v2 header;
+        header.pp_byte_count = sizeof(T);
+        header.pp_byte_flags = type | PP_VERSION_2;
+        header.pp_seq = 12345;
+        header.pp_timestamp = 0x89abcdef;
+        header.pp_host_id = 0x0a000001;
+        header.pp_cpu = 0;
+
+        std::vector<char> datagram(sizeof(header) + sizeof(T));
+        memcpy(datagram.data(), &header, sizeof(header));
+        memcpy(datagram.data() + sizeof(header), &panel_state, sizeof(T));
+        return datagram;
+    }
+
+    std::vector<char> pdp_datagram()
+    {
+        pdp_panel_state state{};
+        state.ps_address = 0x17654;
+        state.ps_data = 0125252;
+        state.ps_psw = 0140000;
+        state.ps_mmr0 = 0x0001;
+        state.ps_mmr3 = 0x0010;
+        return make_datagram(PANEL_PDP1170, state);
+    }
+
+    netbsdx64_panel_state netbsdx64_state()
+    {
+        netbsdx64_panel_state state{};
+        auto& frame = state.ps_frame;
+        frame.cf_rip = 0xffffffff80234567ull;
+        frame.cf_rsp = 0xffff800041234ff0ull;
+        frame.cf_rbp = 0xffff800041235030ull;
+        frame.cf_rax = 0x0000000000000001ull;
+        frame.cf_rbx = 0xffff8000012a4000ull;
+        frame.cf_rcx = 0x00000000deadbeefull;
+        frame.cf_rdx = 0x0000000000001234ull;
+        frame.cf_rdi = 0xffff800000abcdefull;
+        frame.cf_rsi = 0x0000000000000040ull;
+        frame.cf_rflags = 0x246;
+        return state;
+    }
+
+    std::vector<char> netbsdx64_datagram()
+    {
+        return make_datagram(PANEL_NETBSDX64, netbsdx64_state());
+    }
+
+    std::vector<char> netbsdx64_datagram_v2()
+    {
+        return make_datagram_v2(PANEL_NETBSDX64, netbsdx64_state());
+    }
+
+    std::vector<char> vax_datagram()
+    {
+        netbsdvax_panel_state state{};
+        state.ps_address = 0x80012344;
+        state.ps_data = 0x0000beef;
+        return make_datagram(PANEL_VAX, state);
+    }
+
+    // A PP_BATCH packet of count vax samples, 100 microseconds apart
+    std::vector<char> vax_batch_datagram(uint16_t count)
+    {
+        panel_batch_header batch{count, sizeof(netbsdvax_panel_state)};
+        size_t payload_size = sizeof(batch) + count * (sizeof(uint32_t) + sizeof(netbsdvax_panel_state));
+
+        panel_packet_header_v2 header{};
+        header.pp_byte_count = uint16_t(payload_size);
+        header.pp_byte_flags = PANEL_VAX | PP_VERSION_2 | PP_BATCH;
+        header.pp_seq = 12345;
+        header.pp_timestamp = 0x89abcdef;
+
+        std::vector<char> datagram(sizeof(header) + payload_size);
+        char* p = datagram.data();
+        memcpy(p, &header, sizeof(header));
+        memcpy(p += sizeof(header), &batch, sizeof(batch));
+        p += sizeof(batch);
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            uint32_t offset = i * 100;
+            netbsdvax_panel_state state{0x80012344 + 4 * i, 0x0000beef ^ i};
+            memcpy(p, &offset, sizeof(offset));
+            memcpy(p + sizeof(offset), &state, sizeof(state));
+            p += sizeof(offset) + sizeof(state);
+        }
+        return datagram;
+    }
+
+    // Reports allocations and allocated bytes per frame, measured over the timed loop
+    class AllocationCounter
+    {
+    public:
+        AllocationCounter()
+            : start_count(allocation_count)
+            , start_bytes(allocation_bytes)
+        {
+        }
+
+        void report(benchmark::State& state, size_t output_bytes = 0, size_t frames_per_iteration = 1) const
+        {
+            // Read both totals before the counters map allocates its own nodes
+            double count = double(allocation_count - start_count) / double(frames_per_iteration);
+            double bytes = double(allocation_bytes - start_bytes) / double(frames_per_iteration);
+
+            state.counters["allocs/frame"] = benchmark::Counter(count, benchmark::Counter::kAvgIterations);
+            state.counters["bytes/frame"] = benchmark::Counter(bytes, benchmark::Counter::kAvgIterations);
+            if (output_bytes)
+                state.counters["json_bytes"] = double(output_bytes);
+        }
+
+    private:
+        uint64_t start_count;
+        uint64_t start_bytes;
+    };
+
+    // Datagram to JSON, as done by ProxyBase::udp_loop for a single-sample packet
+    template<typename Proxy>
+    void packet_to_json(benchmark::State& state, std::vector<char> datagram)
+    {
+        Exposed<Proxy> proxy(0);
+        std::span<const char> data(datagram.data(), datagram.size());
+        proxy.parse_packet(data);
+        size_t output_bytes = proxy.panel_state_to_json(proxy.packet.sample(0)).size();
+
+        AllocationCounter allocations;
+        for (auto _ : state)
+        {
+            bool ok = proxy.parse_packet(data);
+            std::string json = proxy.panel_state_to_json(proxy.packet.sample(0));
+            benchmark::DoNotOptimize(ok);
+            benchmark::DoNotOptimize(json);
+        }
+        allocations.report(state, output_bytes);
+    }
+
+    void BM_PDProxy_packet_to_json(benchmark::State& state)
+    {
+        packet_to_json<PDProxy>(state, pdp_datagram());
+    }
+
+    void BM_AMD64Proxy_packet_to_json(benchmark::State& state)
+    {
+        packet_to_json<AMD64Proxy>(state, netbsdx64_datagram());
+    }
+
+    void BM_NetBSDVAXProxy_packet_to_json(benchmark::State& state)
+    {
+        packet_to_json<NetBSDVAXProxy>(state, vax_datagram());
+    }
+
+    // All samples of a batched datagram to JSON; the per-frame counters are per sample
+    void BM_NetBSDVAXProxy_batch_to_json(benchmark::State& state)
+    {
+        uint16_t count = uint16_t(state.range(0));
+        Exposed<NetBSDVAXProxy> proxy(0);
+        std::vector<char> datagram = vax_batch_datagram(count);
+        std::span<const char> data(datagram.data(), datagram.size());
+
+        AllocationCounter allocations;
+        for (auto _ : state)
+        {
+            proxy.parse_packet(data);
+            for (size_t i = 0; i < proxy.packet.count; ++i)
+            {
+                std::string json = proxy.panel_state_to_json(proxy.packet.sample(i));
+                uint32_t timestamp = proxy.packet.sample_timestamp(i);
+                benchmark::DoNotOptimize(json);
+                benchmark::DoNotOptimize(timestamp);
+            }
+        }
+        allocations.report(state, 0, count);
+        state.SetItemsProcessed(state.iterations() * count);
+    }
+
+    void parse_packet(benchmark::State& state, std::vector<char> datagram)
+    {
+        BenchProxy proxy;
+        std::span<const char> data(datagram.data(), datagram.size());
+
+        AllocationCounter allocations;
+        for (auto _ : state)
+        {
+            bool ok = proxy.parse_packet(data);
+            benchmark::DoNotOptimize(ok);
+            benchmark::DoNotOptimize(proxy.packet);
+        }
+        allocations.report(state);
+    }
+
+    void BM_ProxyBase_parse_packet(benchmark::State& state)
+    {
+        parse_packet(state, netbsdx64_datagram());
+    }
+
+    void BM_ProxyBase_parse_packet_v2(benchmark::State& state)
+    {
+        parse_packet(state, netbsdx64_datagram_v2());
+    }
+
+    void BM_ProxyBase_parse_packet_batch(benchmark::State& state)
+    {
+        parse_packet(state, vax_batch_datagram(64));
+    }
+
+    void BM_ProxyBase_get_panel_state(benchmark::State& state)
+    {
+        BenchProxy proxy;
+        netbsdx64_panel_state source = netbsdx64_state();
+        std::span<const char> data(reinterpret_cast<const char*>(&source), sizeof(source));
+        netbsdx64_panel_state panel_state;
+
+        AllocationCounter allocations;
+        for (auto _ : state)
+        {
+            bool ok = proxy.get_panel_state(data, panel_state);
+            benchmark::DoNotOptimize(ok);
+            benchmark::DoNotOptimize(panel_state);
+        }
+        allocations.report(state);
+    }
+
+    void BM_ProxyBase_get_panel_state_rejected(benchmark::State& state)
+    {
+        BenchProxy proxy;
+        netbsdvax_panel_state source{};
+        std::span<const char> data(reinterpret_cast<const char*>(&source), sizeof(source));
+        pdp_panel_state panel_state;
+
+        AllocationCounter allocations;
+        for (auto _ : state)
+        {
+            bool ok = proxy.get_panel_state(data, panel_state);
+            benchmark::DoNotOptimize(ok);
+        }
+        allocations.report(state);
+    }
+
+    void BM_ProxyBase_to_hex(benchmark::State& state)
+    {
+        BenchProxy proxy;
+        uint64_t value = 0xffffffff80234567ull;
+
+        AllocationCounter allocations;
+        for (auto _ : state)
+        {
+            benchmark::DoNotOptimize(value);
+            std::string hex = proxy.to_hex(value);
+            benchmark::DoNotOptimize(hex);
+        }
+        allocations.report(state);
+    }
+}
+
+BENCHMARK(BM_PDProxy_packet_to_json);
+BENCHMARK(BM_AMD64Proxy_packet_to_json);
+BENCHMARK(BM_NetBSDVAXProxy_packet_to_json);
+BENCHMARK(BM_NetBSDVAXProxy_batch_to_json)->Arg(16)->Arg(64);
+BENCHMARK(BM_ProxyBase_parse_packet);
+BENCHMARK(BM_ProxyBase_parse_packet_v2);
+BENCHMARK(BM_ProxyBase_parse_packet_batch);
+BENCHMARK(BM_ProxyBase_get_panel_state);
+BENCHMARK(BM_ProxyBase_get_panel_state_rejected);
+BENCHMARK(BM_ProxyBase_to_hex);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,310 @@
+#include "config.hpp"
+#include <algorithm>
+#include <climits>
+#include <fstream>
+#include <iterator>
+#include <set>
+#define CROW_ENABLE_COMPRESSION 1
+#include "crow_all.h"
+
+const std::vector<std::string> proxy_types = {"pdp11", "amd64", "netbsdvax", "linuxx64"};
+
+namespace
+{
+    constexpr unsigned max_workers = 64;
+    constexpr unsigned max_threads = 1024;
+    constexpr int max_cpu = 1023;
+    constexpr int max_priority = 99;
+    constexpr unsigned max_poll_us = 1000000;
+    constexpr size_t min_datagram_size = 64;
+    constexpr size_t max_datagram_size = 65536;
+
+    bool get_unsigned(const crow::json::rvalue& value, uint64_t max, uint64_t& result)
+    {
+        if (value.t() != crow::json::type::Number || value.nt() != crow::json::num_type::Unsigned_integer ||
+            value.u() > max)
+            return false;
+
+        result = value.u();
+        return true;
+    }
+
+    bool get_string(const crow::json::rvalue& value, std::string& result)
+    {
+        if (value.t() != crow::json::type::String)
+            return false;
+
+        result = value.s();
+        return true;
+    }
+
+    bool get_cpus(const crow::json::rvalue& value, std::vector<int>& result)
+    {
+        if (value.t() != crow::json::type::List)
+            return false;
+
+        result.clear();
+        for (size_t i = 0; i < value.size(); i++)
+        {
+            uint64_t cpu;
+            if (!get_unsigned(value[i], max_cpu, cpu))
+                return false;
+            result.push_back(int(cpu));
+        }
+        return true;
+    }
+
+    bool set_web(Config& config, const std::string& key, const crow::json::rvalue& value, std::string& error)
+    {
+        uint64_t number;
+        bool valid;
+        if (key == "port")
+        {
+            valid = get_unsigned(value, USHRT_MAX, number);
+            config.web_port = (unsigned short)number;
+        }
+        else if (key == "content_dir")
+            valid = get_string(value, config.content_dir);
+        else if (key == "threads")
+        {
+            valid = get_unsigned(value, max_threads, number);
+            config.web_threads = unsigned(number);
+        }
+        else
+        {
+            error = "unknown setting web." + key;
+            return false;
+        }
+
+        if (!valid)
+            error = "invalid value for web." + key;
+        return valid;
+    }
+
+    bool set_proxy(ProxyConfig& proxy, const std::string& key, const crow::json::rvalue& value, std::string& error)
+    {
+        ProxyOptions& options = proxy.options;
+        uint64_t number = 0;
+        bool valid;
+        if (key == "name")
+            valid = get_string(value, proxy.name);
+        else if (key == "type")
+            valid = get_string(value, proxy.type);
+        else if (key == "port")
+        {
+            valid = get_unsigned(value, USHRT_MAX, number);
+            proxy.port = (unsigned short)number;
+        }
+        else if (key == "datagram_size")
+        {
+            valid = get_unsigned(value, max_datagram_size, number);
+            options.datagram_size = size_t(number);
+        }
+        else if (key == "receive_buffer")
+        {
+            valid = get_unsigned(value, INT_MAX, number);
+            options.receive_buffer = int(number);
+        }
+        else if (key == "workers")
+        {
+            valid = get_unsigned(value, max_workers, number);
+            options.workers = unsigned(number);
+        }
+        else if (key == "threads")
+        {
+            valid = get_unsigned(value, max_threads, number);
+            options.threads = unsigned(number);
+        }
+        else if (key == "cpus")
+            valid = get_cpus(value, options.cpus);
+        else if (key == "fanout_cpus")
+            valid = get_cpus(value, options.fanout_cpus);
+        else if (key == "priority")
+        {
+            valid = get_unsigned(value, max_priority, number);
+            options.priority = int(number);
+        }
+        else if (key == "busy_poll")
+        {
+            valid = get_unsigned(value, max_poll_us, number);
+            options.busy_poll = unsigned(number);
+        }
+        else if (key == "spin")
+        {
+            valid = get_unsigned(value, max_poll_us, number);
+            options.spin = unsigned(number);
+        }
+        else
+        {
+            error = "unknown setting " + key + " for proxy " + proxy.name;
+            return false;
+        }
+
+        if (!valid)
+            error = "invalid value for " + key + " of proxy " + proxy.name;
+        return valid;
+    }
+
+    std::string quote(const std::string& text)
+    {
+        std::string result = "\"";
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+                result += '\\';
+            result += c;
+        }
+        return result + '"';
+    }
+}
+
+Config default_config()
+{
+    Config config;
+    config.proxies = {
+        {"pdproxy", "pdp11", 4000, {}},
+        {"amd64proxy", "amd64", 4001, {}},
+        {"netbsdvax", "netbsdvax", 4002, {}},
+        {"linuxx64proxy", "linuxx64", 4003, {}},
+    };
+    return config;
+}
+
+bool load_config(const std::string& path, Config& config, std::string& error)
+{
+    std::ifstream file(path);
+    std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (!file)
+    {
+        error = "cannot read " + path;
+        return false;
+    }
+
+    auto json = crow::json::load(text);
+    if (!json || json.t() != crow::json::type::Object)
+    {
+        error = path + " is not a JSON object";
+        return false;
+    }
+
+    // Settings that are left out keep their defaults, except for the proxies, which replace the default ones
+    Config loaded = default_config();
+    for (const auto& member : json)
+    {
+        if (member.key() == "web")
+        {
+            if (member.t() != crow::json::type::Object)
+            {
+                error = "web must be an object";
+                return false;
+            }
+            for (const auto& setting : member)
+            {
+                if (!set_web(loaded, setting.key(), setting, error))
+                    return false;
+            }
+        }
+        else if (member.key() == "proxies")
+        {
+            if (member.t() != crow::json::type::List)
+            {
+                error = "proxies must be a list";
+                return false;
+            }
+            loaded.proxies.clear();
+            for (const auto& entry : member)
+            {
+                if (entry.t() != crow::json::type::Object || !entry.has("name") || !entry.has("type") ||
+                    !entry.has("port"))
+                {
+                    error = "every proxy must be an object with a name, type and port";
+                    return false;
+                }
+
+                ProxyConfig& proxy = loaded.proxies.emplace_back();
+                for (const auto& setting : entry)
+                {
+                    if (!set_proxy(proxy, setting.key(), setting, error))
+                        return false;
+                }
+            }
+        }
+        else
+        {
+            error = "unknown setting " + std::string(member.key());
+            return false;
+        }
+    }
+
+    config = std::move(loaded);
+    return true;
+}
+
+bool override_config(Config& config, const std::string& setting, std::string& error)
+{
+    size_t dot = setting.find('.');
+    size_t equals = setting.find('=');
+    if (dot == std::string::npos || equals == std::string::npos || dot > equals)
+    {
+        error = "expected web.<key>=<value> or <proxy>.<key>=<value>: " + setting;
+        return false;
+    }
+
+    std::string target = setting.substr(0, dot);
+    std::string key = setting.substr(dot + 1, equals - dot - 1);
+    std::string value = setting.substr(equals + 1);
+
+    // The value is parsed as the JSON the configuration file would hold
+    if (key == "content_dir" || key == "name" || key == "type")
+        value = quote(value);
+    else if (key == "cpus" || key == "fanout_cpus")
+        value = "[" + value + "]";
+
+    auto json = crow::json::load(value);
+    if (!json)
+    {
+        error = "invalid value for " + target + "." + key;
+        return false;
+    }
+
+    if (target == "web")
+        return set_web(config, key, json, error);
+
+    for (auto& proxy : config.proxies)
+    {
+        if (proxy.name == target)
+            return set_proxy(proxy, key, json, error);
+    }
+
+    error = "no proxy named " + target;
+    return false;
+}
+
+bool validate_config(const Config& config, std::string& error)
+{
+    std::set<std::string> names;
+    std::set<unsigned short> ports{config.web_port};
+    for (const auto& proxy : config.proxies)
+    {
+        if (proxy.name.empty() || proxy.name == "web" || !names.insert(proxy.name).second)
+            error = "proxy names must be unique and not empty or web: " + proxy.name;
+        else if (std::find(proxy_types.begin(), proxy_types.end(), proxy.type) == proxy_types.end())
+            error = "unknown type " + proxy.type + " of proxy " + proxy.name;
+        else if (proxy.port == 0 || !ports.insert(proxy.port).second)
+            error = "port " + std::to_string(proxy.port) + " of proxy " + proxy.name + " is 0 or in use";
+        else if (proxy.options.datagram_size < min_datagram_size)
+            error = "datagram_size of proxy " + proxy.name + " must be at least " + std::to_string(min_datagram_size);
+        else if (proxy.options.workers == 0)
+            error = "proxy " + proxy.name + " needs at least one worker";
+        else
+            continue;
+        return false;
+    }
+
+    if (config.web_port == 0)
+    {
+        error = "web port must not be 0";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Tuning of one proxy
+struct ProxyOptions
+{
+    size_t datagram_size = 2048;    // receive buffer, and so the largest datagram accepted
+    int receive_buffer = 0;         // SO_RCVBUF of the UDP sockets in bytes, 0 for the system default
+    unsigned workers = 1;           // UDP sockets, each with a thread, sharing the port with SO_REUSEPORT
+    unsigned threads = 0;           // threads serving the WebSocket, 0 for one per CPU
+    std::vector<int> cpus;          // CPUs the UDP threads may run on, empty for any
+    std::vector<int> fanout_cpus;   // CPUs the WebSocket threads may run on, empty for any
+    int priority = 0;               // SCHED_FIFO priority of the UDP threads from 1 to 99, 0 for normal scheduling
+    unsigned busy_poll = 0;         // SO_BUSY_POLL of the UDP sockets in microseconds, 0 for none
+    unsigned spin = 0;              // microseconds a UDP thread keeps polling after a datagram before it sleeps
+
+    bool operator==(const ProxyOptions&) const = default;
+};
+
+struct ProxyConfig
+{
+    std::string name;               // as used in /config.json and the panel page paths
+    std::string type;               // one of proxy_types
+    unsigned short port = 0;        // UDP and WebSocket
+    ProxyOptions options;
+
+    bool operator==(const ProxyConfig&) const = default;
+};
+
+struct Config
+{
+    unsigned short web_port = 4080;
+    std::string content_dir;        // empty to serve the content built into udproxy
+    unsigned web_threads = 0;       // 0 for one per CPU
+    std::vector<ProxyConfig> proxies;
+};
+
+// The panel types a proxy can be declared with
+extern const std::vector<std::string> proxy_types;
+
+// The configuration udproxy runs with when there is no configuration file
+Config default_config();
+
+// Replaces config with the contents of a JSON configuration file, see udproxy.json. Returns false with
+// a description of the problem in error if the file cannot be read or is not valid.
+bool load_config(const std::string& path, Config& config, std::string& error);
+
+// Changes one setting of config, given as web.<key>=<value> or <proxy name>.<key>=<value>, with the keys
+// of the configuration file; lists such as cpus are separated by commas
+bool override_config(Config& config, const std::string& setting, std::string& error);
+
+// Checks that proxy names and ports are unique and that the settings are within range
+bool validate_config(const Config& config, std::string& error);
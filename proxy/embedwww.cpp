@@ -0,0 +1,100 @@
+// Compiles a web content directory into a C++ source file that defines embedded_assets (see
+// webcontent.hpp), with the content types, ETags and gzip copies the web server would compute itself.
+// The Makefile runs it to build wwwroot into udproxy.
+#include "assetcache.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace
+{
+    // Writes data as an array of bytes, unless it is empty, in which case there is no array to point to
+    void write_bytes(FILE* out, const std::string& name, std::string_view data)
+    {
+        if (data.empty())
+            return;
+
+        fprintf(out, "constexpr unsigned char %s[] = {", name.c_str());
+        for (size_t i = 0; i < data.size(); i++)
+            fprintf(out, "%s%u,", i % 24 == 0 ? "\n    " : "", (unsigned char)data[i]);
+        fprintf(out, "\n};\n\n");
+    }
+
+    // Paths, types and ETags are plain text, but quotes in ETags and odd characters in file names are escaped
+    std::string quote(std::string_view text)
+    {
+        std::string result = "\"";
+        for (unsigned char c : text)
+        {
+            if (c == '"' || c == '\\')
+            {
+                result += '\\';
+                result += char(c);
+            }
+            else if (c < 0x20 || c >= 0x7f)
+            {
+                char escape[8];
+                snprintf(escape, sizeof(escape), "\\%03o", c);
+                result += escape;
+            }
+            else
+                result += char(c);
+        }
+        return result + '"';
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc != 3)
+    {
+        fprintf(stderr, "Usage: %s content_dir output.cpp\n", argv[0]);
+        return 1;
+    }
+
+    AssetCache cache(argv[1], {});
+    cache.load();
+
+    // In a fixed order, so that the output only changes when the content does
+    std::vector<std::pair<std::string, const AssetCache::Asset*>> files;
+    cache.for_each([&](const std::string& path, const AssetCache::Asset& asset) { files.emplace_back(path, &asset); });
+    std::sort(files.begin(), files.end());
+    if (files.empty())
+    {
+        fprintf(stderr, "No files in %s\n", argv[1]);
+        return 1;
+    }
+
+    FILE* out = fopen(argv[2], "w");
+    if (!out)
+    {
+        perror(argv[2]);
+        return 1;
+    }
+
+    fprintf(out, "// Generated by embedwww from %s; do not edit\n#include \"webcontent.hpp\"\n\nnamespace\n{\n\n", argv[1]);
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        write_bytes(out, "body_" + std::to_string(i), files[i].second->body);
+        write_bytes(out, "gzip_" + std::to_string(i), files[i].second->gzip);
+    }
+    fprintf(out, "}\n\nconst EmbeddedAsset embedded_assets[] = {\n");
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        const auto& [path, asset] = files[i];
+        std::string body = asset->body.empty() ? "nullptr" : "body_" + std::to_string(i);
+        std::string gzip = asset->gzip.empty() ? "nullptr" : "gzip_" + std::to_string(i);
+        fprintf(out, "    {%s, %s, %s, %s, %zu, %s, %zu},\n", quote(path).c_str(), quote(asset->content_type).c_str(),
+                quote(asset->etag).c_str(), body.c_str(), asset->body.size(), gzip.c_str(), asset->gzip.size());
+    }
+    fprintf(out, "};\n\nconst size_t embedded_asset_count = %zu;\n", files.size());
+
+    if (fclose(out) != 0)
+    {
+        perror(argv[2]);
+        return 1;
+    }
+    return 0;
+}
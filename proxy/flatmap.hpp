@@ -0,0 +1,171 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Hash map from 64-bit keys that keeps its entries in one flat array and resolves collisions by linear
+// probing. A lookup usually touches a single cache line instead of following list nodes, which counts
+// when thousands of entries are looked up for every packet. Erasing moves later entries of the probe
+// sequence back, so there are no tombstones and lookups do not slow down as entries come and go.
+// Pointers to values are invalidated by inserting and erasing.
+template<typename Value>
+class FlatHashMap
+{
+public:
+    explicit FlatHashMap(size_t capacity = 16)
+        : slots(round_up(capacity))
+    {
+    }
+
+    size_t size() const { return count; }
+
+    Value* find(uint64_t key)
+    {
+        for (size_t i = home(key);; i = next(i))
+        {
+            if (!slots[i].used)
+                return nullptr;
+            if (slots[i].key == key)
+                return &slots[i].value;
+        }
+    }
+
+    const Value* find(uint64_t key) const { return const_cast<FlatHashMap*>(this)->find(key); }
+
+    // Value for key, default-constructed if there was none
+    Value& operator[](uint64_t key)
+    {
+        if (Value* value = find(key))
+            return *value;
+
+        // Keep the table at most three quarters full, so probe sequences stay short
+        if ((count + 1) * 4 > slots.size() * 3)
+            rehash(slots.size() * 2);
+
+        size_t i = home(key);
+        while (slots[i].used)
+            i = next(i);
+
+        slots[i].used = true;
+        slots[i].key = key;
+        slots[i].value = Value();
+        count++;
+        return slots[i].value;
+    }
+
+    bool erase(uint64_t key)
+    {
+        size_t i = home(key);
+        for (;; i = next(i))
+        {
+            if (!slots[i].used)
+                return false;
+            if (slots[i].key == key)
+                break;
+        }
+
+        // Move back entries that would no longer be found past the hole, until an empty slot
+        for (size_t j = next(i); slots[j].used; j = next(j))
+        {
+            size_t wanted = home(slots[j].key);
+            bool reachable = i <= j ? (wanted > i && wanted <= j) : (wanted > i || wanted <= j);
+            if (!reachable)
+            {
+                slots[i].key = slots[j].key;
+                slots[i].value = std::move(slots[j].value);
+                i = j;
+            }
+        }
+
+        slots[i].used = false;
+        slots[i].value = Value();
+        count--;
+        return true;
+    }
+
+    // Calls f(key, value) for every entry, in no particular order
+    template<typename F>
+    void for_each(F f)
+    {
+        for (auto& slot : slots)
+        {
+            if (slot.used)
+                f(slot.key, slot.value);
+        }
+    }
+
+    template<typename F>
+    void for_each(F f) const
+    {
+        for (const auto& slot : slots)
+        {
+            if (slot.used)
+                f(slot.key, slot.value);
+        }
+    }
+
+    // Erases the entries for which pred(key, value) is true
+    template<typename Pred>
+    void erase_if(Pred pred)
+    {
+        std::vector<uint64_t> keys;
+        for_each([&](uint64_t key, Value& value)
+        {
+            if (pred(key, value))
+                keys.push_back(key);
+        });
+        for (uint64_t key : keys)
+            erase(key);
+    }
+
+private:
+    struct Slot
+    {
+        uint64_t key = 0;
+        bool used = false;
+        Value value{};
+    };
+
+    static size_t round_up(size_t capacity)
+    {
+        size_t size = 8;
+        while (size < capacity)
+            size *= 2;
+        return size;
+    }
+
+    // Keys such as IPv4 addresses and host ids differ mostly in a few bits, so mix them (splitmix64)
+    size_t home(uint64_t key) const
+    {
+        key ^= key >> 30;
+        key *= 0xbf58476d1ce4e5b9ULL;
+        key ^= key >> 27;
+        key *= 0x94d049bb133111ebULL;
+        key ^= key >> 31;
+        return size_t(key) & (slots.size() - 1);
+    }
+
+    size_t next(size_t i) const { return (i + 1) & (slots.size() - 1); }
+
+    void rehash(size_t capacity)
+    {
+        std::vector<Slot> old(capacity);
+        old.swap(slots);
+        for (auto& slot : old)
+        {
+            if (!slot.used)
+                continue;
+
+            size_t i = home(slot.key);
+            while (slots[i].used)
+                i = next(i);
+            slots[i].used = true;
+            slots[i].key = slot.key;
+            slots[i].value = std::move(slot.value);
+        }
+    }
+
+    std::vector<Slot> slots;
+    size_t count = 0;
+};
@@ -0,0 +1,70 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+// How long datagrams take from arriving, as timestamped by the kernel (SO_TIMESTAMP), until a UDP
+// thread has handed their samples to the WebSocket clients. Most of the variation is the time the
+// thread takes to wake up and be scheduled, so this shows the effect of the affinity, priority,
+// busy-poll and spin options. The delays are counted in power-of-two buckets of microseconds, from
+// which percentiles are estimated.
+class IngestStats
+{
+public:
+    void record_delay(int64_t delay_us)
+    {
+        // Clocks can be stepped between the kernel timestamp and reading it
+        uint64_t delay = uint64_t(std::max<int64_t>(delay_us, 0));
+
+        size_t bucket = 0;
+        while (bucket + 1 < buckets.size() && delay >= (uint64_t(1) << bucket))
+            bucket++;
+        buckets[bucket]++;
+
+        count++;
+        total += delay;
+        max = std::max(max, delay);
+
+        // Smoothed like RFC 3550 interarrival jitter: the mean change in delay from one datagram to the next
+        if (count > 1)
+            jitter += (std::abs(double(delay) - double(last)) - jitter) / 16.0;
+        last = delay;
+    }
+
+    // Serializes the statistics as {"datagrams":...,"delay_us":{"mean":...,"p50":...,"p99":...,"max":...},"jitter_us":...}
+    std::string to_json() const
+    {
+        char json[256];
+        snprintf(json, sizeof(json),
+                "{\"datagrams\":%llu,\"delay_us\":{\"mean\":%.1f,\"p50\":%llu,\"p99\":%llu,\"max\":%llu},\"jitter_us\":%.1f}",
+                (unsigned long long)count, count ? double(total) / double(count) : 0.0,
+                (unsigned long long)percentile(0.50), (unsigned long long)percentile(0.99), (unsigned long long)max,
+                jitter);
+        return json;
+    }
+
+private:
+    // Upper bound of the bucket that holds the given fraction of the delays
+    uint64_t percentile(double fraction) const
+    {
+        uint64_t wanted = uint64_t(std::ceil(double(count) * fraction));
+        uint64_t seen = 0;
+        for (size_t bucket = 0; bucket < buckets.size(); bucket++)
+        {
+            seen += buckets[bucket];
+            if (seen >= wanted && seen > 0)
+                return std::min(max, bucket == 0 ? 0 : (uint64_t(1) << bucket) - 1);
+        }
+        return max;
+    }
+
+    std::array<uint64_t, 32> buckets{};     // bucket b holds delays below 2^b microseconds
+    uint64_t count = 0;
+    uint64_t total = 0;
+    uint64_t max = 0;
+    uint64_t last = 0;
+    double jitter = 0.0;
+};
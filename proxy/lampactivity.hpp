@@ -0,0 +1,66 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <span>
+#include <string>
+
+// A row of lamps on a panel, such as the address or data lamps
+struct LampRegister
+{
+    const char* name;
+    unsigned bits;
+};
+
+// The lamp registers of one sample, in the order the proxy lists them
+struct PanelLamps
+{
+    static constexpr size_t max_words = 4;
+    std::array<uint64_t, max_words> words{};
+};
+
+// What the lamps did over the samples a rate-capped client was not sent: which bits were lit in any of
+// them, and the lowest and highest value of each register. Attached to the sample that is sent, so that
+// lamps that flicker faster than the client's rate still show.
+class LampActivity
+{
+public:
+    void add(const PanelLamps& lamps)
+    {
+        if (samples++ == 0)
+        {
+            lit = min = max = lamps;
+            return;
+        }
+        for (size_t i = 0; i < PanelLamps::max_words; i++)
+        {
+            lit.words[i] |= lamps.words[i];
+            min.words[i] = std::min(min.words[i], lamps.words[i]);
+            max.words[i] = std::max(max.words[i], lamps.words[i]);
+        }
+    }
+
+    bool empty() const { return samples == 0; }
+    void clear() { samples = 0; }
+
+    // Adds "activity":{"samples":...,"<name>":{"or":...,"min":...,"max":...},...} to a state object
+    std::string attach(const std::string& json, std::span<const LampRegister> registers) const
+    {
+        if (json.size() < 2 || json.back() != '}')
+            return json;
+
+        std::string result = json.substr(0, json.size() - 1) + ",\"activity\":{\"samples\":" + std::to_string(samples);
+        for (size_t i = 0; i < registers.size() && i < PanelLamps::max_words; i++)
+        {
+            result += ",\"" + std::string(registers[i].name) + "\":{\"or\":" + std::to_string(lit.words[i]) +
+                      ",\"min\":" + std::to_string(min.words[i]) + ",\"max\":" + std::to_string(max.words[i]) + '}';
+        }
+        return result + "}}";
+    }
+
+private:
+    PanelLamps lit;
+    PanelLamps min;
+    PanelLamps max;
+    uint64_t samples = 0;
+};
@@ -0,0 +1,33 @@
+#include "linuxx64proxy.hpp"
+#include <cstring>
+
+LinuxX64Proxy::LinuxX64Proxy(unsigned short port)
+    : ProxyBase(port)
+{
+    log_info("Structure sizes: header=%zu bytes, panel_state=%zu bytes, total_packet=%zu bytes",
+             sizeof(panel_packet_header), sizeof(linuxx64_panel_state), sizeof(linuxx64_panel_packet));
+}
+
+std::string LinuxX64Proxy::panel_state_to_json(std::span<const char> data)
+{
+    // Parse the Linux x64 panel state, the kernel's pt_regs
+    linuxx64_panel_state panel_state;
+    if (!get_panel_state(data, panel_state))
+        return "";
+
+    auto& regs = panel_state.ps_regs;
+
+    crow::json::wvalue json;
+    json["rax"]    = to_hex(regs.rax);
+    json["rbx"]    = to_hex(regs.rbx);
+    json["rcx"]    = to_hex(regs.rcx);
+    json["rdx"]    = to_hex(regs.rdx);
+    json["rdi"]    = to_hex(regs.rdi);
+    json["rsi"]    = to_hex(regs.rsi);
+    json["rbp"]    = to_hex(regs.rbp);
+    json["rsp"]    = to_hex(regs.rsp);
+    json["rip"]    = to_hex(regs.rip);
+    json["rflags"] = to_hex(regs.eflags);
+
+    return json.dump();
+}
@@ -0,0 +1,14 @@
+#pragma once
+#include "proxybase.hpp"
+
+// Linux x64 hosts, which send the registers of every CPU as a stream of its own (see socket/arch/LinuxX64).
+// The states carry the same registers as those of AMD64Proxy, so the AMD64 panel page shows them.
+class LinuxX64Proxy : public ProxyBase
+{
+public:
+    LinuxX64Proxy(unsigned short port);
+    ~LinuxX64Proxy() override = default;
+    std::string panel_state_to_json(std::span<const char> data) override;
+    panel_type handled_type() const override { return PANEL_LINUXX64; }
+    const char* module_name() const override { return "LinuxX64Proxy"; }
+};
@@ -0,0 +1,666 @@
+// loadgen.cpp - High-rate UDP load generator for the panel proxies
+//
+// Emulates a number of simulated hosts of each panel type, each evolving its registers frame by
+// frame and sending panel packets at a fixed per-host rate (or as fast as possible). Datagrams that
+// are due at the same time are handed to the kernel in batches with sendmmsg() where available.
+
+#include "types.hpp"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    struct PanelType
+    {
+        const char* name;
+        panel_type type;
+        unsigned short port;        // default proxy port, as used by the matching client in socket/arch
+        size_t payload_size;
+    };
+
+    const PanelType panel_types[] = {
+        { "pdp11",     PANEL_PDP1170,   4000, sizeof(pdp_panel_state) },
+        { "vax",       PANEL_VAX,       4002, sizeof(netbsdvax_panel_state) },
+        { "netbsdx64", PANEL_NETBSDX64, 4001, sizeof(netbsdx64_panel_state) },
+        { "linuxx64",  PANEL_LINUXX64,  4003, sizeof(linuxx64_panel_state) },
+        { "macos",     PANEL_MACOS,     4000, sizeof(macos_panel_state) },
+    };
+
+    constexpr size_t panel_type_count = sizeof(panel_types) / sizeof(panel_types[0]);
+    constexpr size_t max_packet_size = 1472;        // UDP payload that fits a 1500-byte Ethernet MTU
+
+    enum class Evolution
+    {
+        Realistic,
+        Randomized,
+        Probe,          // vax frames carry host index, sequence number and send time, for wsbench
+    };
+
+    struct Options
+    {
+        std::string server_ip = "127.0.0.1";
+        unsigned hosts_per_type = 1;
+        bool enabled[panel_type_count] = { true, true, true, true, true };
+        unsigned short ports[panel_type_count] = {};
+        double rate = 60.0;             // frames per second per host, 0 = as fast as possible
+        unsigned batch = 64;            // datagrams per sendmmsg() call
+        unsigned workers = 1;
+        unsigned duration = 0;          // seconds, 0 = until interrupted
+        Evolution evolution = Evolution::Realistic;
+        bool legacy = false;            // send version 1 packets, without sequence numbers
+        unsigned samples = 1;           // samples per datagram; more than one sends PP_BATCH packets
+    };
+
+    std::atomic<bool> stop_requested{false};
+
+    uint64_t now_ns()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return uint64_t(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+    }
+
+    // Sleep until an absolute CLOCK_MONOTONIC deadline, so pacing does not drift
+    void sleep_until_ns(uint64_t deadline)
+    {
+#ifdef __linux__
+        timespec ts;
+        ts.tv_sec = deadline / 1000000000ull;
+        ts.tv_nsec = deadline % 1000000000ull;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR && !stop_requested.load())
+            ;
+#else
+        uint64_t now = now_ns();
+        if (deadline > now)
+        {
+            timespec ts;
+            ts.tv_sec = (deadline - now) / 1000000000ull;
+            ts.tv_nsec = (deadline - now) % 1000000000ull;
+            nanosleep(&ts, nullptr);
+        }
+#endif
+    }
+
+    // xorshift64* - cheap enough to call for every register on every frame
+    struct Random
+    {
+        uint64_t state;
+
+        explicit Random(uint64_t seed) : state(seed ? seed : 0x9E3779B97F4A7C15ull) {}
+
+        uint64_t next()
+        {
+            state ^= state >> 12;
+            state ^= state << 25;
+            state ^= state >> 27;
+            return state * 0x2545F4914F6CDD1Dull;
+        }
+
+        // True with a probability of 1 in n
+        bool one_in(uint64_t n) { return next() % n == 0; }
+    };
+
+    // One emulated machine. "Realistic" evolution walks a program counter through short runs of
+    // sequential code with occasional jumps, and lets the other registers drift; randomized
+    // evolution fills the whole panel state with noise. Probe evolution makes vax frames
+    // self-describing: ps_address holds the host index in its top 8 bits and a 24-bit sequence
+    // number below it, and ps_data holds the CLOCK_MONOTONIC send time in microseconds (mod 2^32).
+    class SimulatedHost
+    {
+    public:
+        SimulatedHost(const PanelType& type, unsigned index, const Options& options)
+            : type(type)
+            , index(index)
+            , random(0xC0FFEEull * (uint64_t(type.type) << 32 | index) + index + 1)
+            , evolution(options.evolution)
+            , legacy(options.legacy)
+        {
+            pc = random.next();
+            data = random.next();
+
+            // As many samples per batch as were asked for and fit in a datagram
+            size_t room = max_packet_size - sizeof(panel_packet_header_v2) - sizeof(panel_batch_header);
+            samples = std::max<size_t>(1, std::min<size_t>(options.samples, room / (sizeof(uint32_t) + type.payload_size)));
+            sample_interval = options.rate > 0 ? uint32_t(1e6 / (options.rate * samples)) : 0;
+        }
+
+        // Advance the registers by one frame, or one batch of frames, and write the next datagram;
+        // returns its size
+        size_t next_packet(char* buffer)
+        {
+            if (samples > 1)
+                return next_batch(buffer);
+
+            size_t header_size = legacy ? sizeof(panel_packet_header) : sizeof(panel_packet_header_v2);
+            write_header(buffer, type.payload_size, 0, uint32_t(now_ns() / 1000));
+            next_state(buffer + header_size);
+            return header_size + type.payload_size;
+        }
+
+    private:
+        // The samples of a batch are sample_interval apart, the last one taken just now
+        size_t next_batch(char* buffer)
+        {
+            panel_batch_header batch{uint16_t(samples), uint16_t(type.payload_size)};
+            size_t payload_size = sizeof(batch) + samples * (sizeof(uint32_t) + type.payload_size);
+            uint32_t first = uint32_t(now_ns() / 1000) - uint32_t(samples - 1) * sample_interval;
+            write_header(buffer, payload_size, PP_BATCH, first);
+
+            char* p = buffer + sizeof(panel_packet_header_v2);
+            memcpy(p, &batch, sizeof(batch));
+            p += sizeof(batch);
+            for (uint32_t i = 0; i < samples; ++i)
+            {
+                uint32_t offset = i * sample_interval;
+                memcpy(p, &offset, sizeof(offset));
+                next_state(p + sizeof(offset));
+                p += sizeof(offset) + type.payload_size;
+            }
+
+            return sizeof(panel_packet_header_v2) + payload_size;
+        }
+
+        void write_header(char* buffer, size_t byte_count, uint32_t flags, uint32_t timestamp)
+        {
+            if (legacy)
+            {
+                panel_packet_header header;
+                header.pp_byte_count = uint16_t(byte_count);
+                header.pp_byte_flags = type.type;
+                memcpy(buffer, &header, sizeof(header));
+                return;
+            }
+
+            // Every simulated host gets its own host id: the panel type in the top byte, the index below
+            panel_packet_header_v2 header;
+            header.pp_byte_count = uint16_t(byte_count);
+            header.pp_byte_flags = type.type | PP_VERSION_2 | flags;
+            header.pp_seq = frames;
+            header.pp_timestamp = timestamp;
+            header.pp_host_id = (uint32_t(type.type) << 24) | index;
+            header.pp_cpu = 0;
+            memcpy(buffer, &header, sizeof(header));
+            frames += samples;
+        }
+
+        void next_state(char* payload)
+        {
+            if (evolution == Evolution::Randomized)
+                fill_random(payload);
+            else if (evolution == Evolution::Probe && type.type == PANEL_VAX)
+                probe(payload);
+            else
+                evolve(payload);
+        }
+
+        void fill_random(char* payload)
+        {
+            for (size_t i = 0; i < type.payload_size; i += sizeof(uint64_t))
+            {
+                uint64_t value = random.next();
+                memcpy(payload + i, &value, std::min(sizeof(value), type.payload_size - i));
+            }
+        }
+
+        void probe(char* payload)
+        {
+            netbsdvax_panel_state state;
+            state.ps_address = (index << 24) | (sequence++ & 0xffffff);
+            state.ps_data = uint32_t(now_ns() / 1000);
+            memcpy(payload, &state, sizeof(state));
+        }
+
+        void evolve(char* payload)
+        {
+            // Mostly sequential execution, with a jump to another routine now and then
+            if (random.one_in(40))
+                pc = random.next();
+            else
+                pc += 2 + 2 * (random.next() & 3);
+
+            if (random.one_in(8))
+                data = random.next();
+            else
+                data += 1;
+
+            if (random.one_in(120))
+                user_mode = !user_mode;
+
+            switch (type.type)
+            {
+                case PANEL_PDP1170:
+                {
+                    pdp_panel_state state{};
+                    state.ps_address = uint32_t(pc) & 0x3fffff;
+                    state.ps_data = uint16_t(data);
+                    state.ps_psw = user_mode ? 0xf000 : 0x0000;     // current/previous mode
+                    state.ps_mmr0 = 0x0001;                         // MMU enabled
+                    state.ps_mmr3 = 0x0010;                         // 22-bit addressing
+                    memcpy(payload, &state, sizeof(state));
+                    break;
+                }
+                case PANEL_VAX:
+                {
+                    netbsdvax_panel_state state{};
+                    state.ps_address = (user_mode ? 0x00001000u : 0x80000000u) | (uint32_t(pc) & 0x003fffff);
+                    state.ps_data = uint32_t(data);
+                    memcpy(payload, &state, sizeof(state));
+                    break;
+                }
+                case PANEL_NETBSDX64:
+                {
+                    netbsdx64_panel_state state{};
+                    auto& frame = state.ps_frame;
+                    frame.cf_rip = user_mode ? 0x0000000000400000ull | (pc & 0xfffff) : 0xffffffff80200000ull | (pc & 0xfffff);
+                    frame.cf_rsp = (user_mode ? 0x00007f7fff000000ull : 0xffff800040000000ull) | (data & 0xff0);
+                    frame.cf_rbp = frame.cf_rsp + 0x40;
+                    frame.cf_rax = data;
+                    frame.cf_rbx = data >> 8;
+                    frame.cf_rcx = pc >> 16;
+                    frame.cf_rdx = random.next() & 0xffff;
+                    frame.cf_rdi = data ^ pc;
+                    frame.cf_rsi = data + pc;
+                    frame.cf_rflags = 0x246;
+                    frame.cf_cs = user_mode ? 0x47 : 0x08;
+                    frame.cf_ss = user_mode ? 0x3f : 0x10;
+                    memcpy(payload, &state, sizeof(state));
+                    break;
+                }
+                case PANEL_LINUXX64:
+                {
+                    linuxx64_panel_state state{};
+                    auto& regs = state.ps_regs;
+                    regs.rip = 0xffffffff81000000ull | (pc & 0xffffff);
+                    regs.rsp = 0xffffc90000000000ull | (data & 0x3ff0);
+                    regs.rbp = regs.rsp + 0x30;
+                    regs.rax = data;
+                    regs.rbx = data >> 8;
+                    regs.rcx = pc >> 16;
+                    regs.rdx = random.next() & 0xffff;
+                    regs.rdi = data ^ pc;
+                    regs.rsi = data + pc;
+                    regs.orig_rax = ~0ull;
+                    regs.eflags = 0x246;
+                    regs.cs = 0x10;
+                    regs.ss = 0x18;
+                    memcpy(payload, &state, sizeof(state));
+                    break;
+                }
+                case PANEL_MACOS:
+                {
+                    macos_panel_state state{};
+                    state.pc = 0x0000000100000000ull | (pc & 0xffffff);
+                    state.sp = 0x000000016f000000ull | (data & 0xfff0);
+                    state.fp = state.sp + 0x20;
+                    state.lr = state.pc + 0x40;
+                    state.x0 = data;
+                    state.x1 = data >> 8;
+                    state.cpu_usage = uint32_t(data % 101);
+                    state.memory_usage = 60;
+                    state.load_average = 150;
+                    state.thread_count = 4;
+                    state.architecture = 1;
+                    state.timestamp = uint32_t(now_ns() / 1000);
+                    memcpy(payload, &state, sizeof(state));
+                    break;
+                }
+            }
+        }
+
+        const PanelType& type;
+        uint32_t index;
+        Random random;
+        Evolution evolution;
+        bool legacy;
+        uint32_t samples;               // per datagram
+        uint32_t sample_interval;       // microseconds between the samples in a batch
+        uint32_t sequence = 0;
+        uint32_t frames = 0;
+        uint64_t pc = 0;
+        uint64_t data = 0;
+        bool user_mode = false;
+    };
+
+    struct WorkerStats
+    {
+        std::atomic<uint64_t> packets{0};
+        std::atomic<uint64_t> bytes{0};
+        std::atomic<uint64_t> errors{0};
+    };
+
+    class Worker
+    {
+    public:
+        Worker(const Options& options, WorkerStats& stats)
+            : options(options)
+            , stats(stats)
+        {
+            for (size_t i = 0; i < panel_type_count; ++i)
+            {
+                sockaddr_in& addr = destinations[i];
+                memset(&addr, 0, sizeof(addr));
+                addr.sin_family = AF_INET;
+                addr.sin_port = htons(options.ports[i]);
+                inet_pton(AF_INET, options.server_ip.c_str(), &addr.sin_addr);
+            }
+        }
+
+        void add_host(size_t type_index, unsigned index)
+        {
+            hosts.emplace_back(panel_types[type_index], index, options);
+            host_types.push_back(type_index);
+        }
+
+        bool empty() const { return hosts.empty(); }
+
+        void run()
+        {
+            sock = socket(AF_INET, SOCK_DGRAM, 0);
+            if (sock < 0)
+            {
+                perror("socket");
+                return;
+            }
+
+            size_t batch = std::max(1u, options.batch);
+            buffers.resize(batch * max_packet_size);
+            iovecs.resize(batch);
+#ifdef __linux__
+            messages.resize(batch);
+#endif
+
+            // Spread the hosts evenly over one frame period, so each one is paced at exactly the
+            // requested rate without all of them firing at once
+            uint64_t period = options.rate > 0 ? uint64_t(1e9 / options.rate) : 0;
+            uint64_t start = now_ns();
+            uint64_t frame = 0;
+            size_t cursor = 0;
+
+            while (!stop_requested.load())
+            {
+                size_t count = 0;
+                uint64_t due = 0;
+
+                while (count < batch)
+                {
+                    due = start + frame * period + (period * cursor) / hosts.size();
+                    if (period && due > now_ns())
+                        break;
+
+                    char* buffer = &buffers[count * max_packet_size];
+                    size_t size = hosts[cursor].next_packet(buffer);
+                    queue(count++, buffer, size, host_types[cursor]);
+
+                    if (++cursor == hosts.size())
+                    {
+                        cursor = 0;
+                        ++frame;
+                    }
+                }
+
+                if (count > 0)
+                    send(count);
+                else
+                    sleep_until_ns(due);
+            }
+
+            close(sock);
+        }
+
+    private:
+        void queue(size_t slot, char* buffer, size_t size, size_t type_index)
+        {
+            iovecs[slot].iov_base = buffer;
+            iovecs[slot].iov_len = size;
+#ifdef __linux__
+            msghdr& msg = messages[slot].msg_hdr;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_name = &destinations[type_index];
+            msg.msg_namelen = sizeof(sockaddr_in);
+            msg.msg_iov = &iovecs[slot];
+            msg.msg_iovlen = 1;
+#else
+            slot_types.resize(std::max(slot_types.size(), slot + 1));
+            slot_types[slot] = type_index;
+#endif
+        }
+
+        void send(size_t count)
+        {
+#ifdef __linux__
+            size_t sent = 0;
+            while (sent < count)
+            {
+                int n = sendmmsg(sock, &messages[sent], unsigned(count - sent), 0);
+                if (n < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    // Drop the rest of this batch, e.g. ENOBUFS or ECONNREFUSED from ICMP
+                    stats.errors += count - sent;
+                    break;
+                }
+                sent += n;
+            }
+            for (size_t i = 0; i < sent; ++i)
+                stats.bytes += iovecs[i].iov_len;
+            stats.packets += sent;
+#else
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (sendto(sock, iovecs[i].iov_base, iovecs[i].iov_len, 0,
+                           (sockaddr*)&destinations[slot_types[i]], sizeof(sockaddr_in)) < 0)
+                    stats.errors++;
+                else
+                {
+                    stats.packets++;
+                    stats.bytes += iovecs[i].iov_len;
+                }
+            }
+#endif
+        }
+
+        const Options& options;
+        WorkerStats& stats;
+        int sock = -1;
+        sockaddr_in destinations[panel_type_count];
+        std::vector<SimulatedHost> hosts;
+        std::vector<size_t> host_types;
+        std::vector<char> buffers;
+        std::vector<iovec> iovecs;
+#ifdef __linux__
+        std::vector<mmsghdr> messages;
+#else
+        std::vector<size_t> slot_types;
+#endif
+    };
+
+    void usage(const char* progname)
+    {
+        printf("Usage: %s [-s server_ip] [-k hosts] [-t types] [-p type=port] [-r rate] [-b batch] [-j workers] [-d seconds] [-R | -T] [-1 | -B samples]\n", progname);
+        printf("  -s server_ip   IP address of the proxy (default: 127.0.0.1)\n");
+        printf("  -k hosts       simulated hosts per panel type (default: 1)\n");
+        printf("  -t types       comma-separated panel types (default: pdp11,vax,netbsdx64,linuxx64,macos)\n");
+        printf("  -p type=port   UDP port for a panel type (defaults match the socket/arch clients)\n");
+        printf("  -r rate        datagrams per second per host, 0 for line rate (default: 60)\n");
+        printf("  -b batch       datagrams per sendmmsg() call (default: 64)\n");
+        printf("  -j workers     sending threads (default: 1)\n");
+        printf("  -d seconds     stop after this many seconds (default: run until interrupted)\n");
+        printf("  -R             randomized instead of realistic register evolution\n");
+        printf("  -T             probe mode: vax frames carry host index, sequence number and send time\n");
+        printf("  -1             send version 1 packets, without sequence numbers and timestamps\n");
+        printf("  -B samples     batch this many samples per datagram, sampling at rate * samples\n");
+        printf("  -h             Show this help\n");
+    }
+
+    int find_panel_type(const std::string& name)
+    {
+        for (size_t i = 0; i < panel_type_count; ++i)
+        {
+            if (name == panel_types[i].name)
+                return int(i);
+        }
+
+        fprintf(stderr, "Unknown panel type: %s\n", name.c_str());
+        return -1;
+    }
+
+    bool parse_types(const char* list, Options& options)
+    {
+        for (auto& enabled : options.enabled)
+            enabled = false;
+
+        std::string types(list);
+        size_t pos = 0;
+        while (pos <= types.size())
+        {
+            size_t comma = types.find(',', pos);
+            if (comma == std::string::npos)
+                comma = types.size();
+
+            int index = find_panel_type(types.substr(pos, comma - pos));
+            if (index < 0)
+                return false;
+            options.enabled[index] = true;
+            pos = comma + 1;
+        }
+
+        return true;
+    }
+
+    bool parse_port(const char* arg, Options& options)
+    {
+        const char* equals = strchr(arg, '=');
+        if (equals == nullptr)
+        {
+            fprintf(stderr, "Expected type=port: %s\n", arg);
+            return false;
+        }
+
+        int index = find_panel_type(std::string(arg, equals - arg));
+        if (index < 0)
+            return false;
+        options.ports[index] = (unsigned short)atoi(equals + 1);
+        return true;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    int c;
+
+    for (size_t i = 0; i < panel_type_count; ++i)
+        options.ports[i] = panel_types[i].port;
+
+    while ((c = getopt(argc, argv, "s:k:t:p:r:b:j:d:RT1B:h")) != -1)
+    {
+        switch (c)
+        {
+        case 's': options.server_ip = optarg; break;
+        case 'k': options.hosts_per_type = unsigned(atoi(optarg)); break;
+        case 't': if (!parse_types(optarg, options)) return 1; break;
+        case 'p': if (!parse_port(optarg, options)) return 1; break;
+        case 'r': options.rate = atof(optarg); break;
+        case 'b': options.batch = unsigned(atoi(optarg)); break;
+        case 'j': options.workers = std::max(1, atoi(optarg)); break;
+        case 'd': options.duration = unsigned(atoi(optarg)); break;
+        case 'R': options.evolution = Evolution::Randomized; break;
+        case 'T': options.evolution = Evolution::Probe; break;
+        case '1': options.legacy = true; break;
+        case 'B': options.samples = unsigned(atoi(optarg)); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (options.legacy && options.samples > 1)
+    {
+        fprintf(stderr, "Batches (-B) require version 2 packets\n");
+        return 1;
+    }
+
+    std::signal(SIGINT, [](int) { stop_requested.store(true); });
+    std::signal(SIGTERM, [](int) { stop_requested.store(true); });
+
+    // Deal the hosts out over the workers round-robin, so each gets a similar mix of panel types
+    std::vector<WorkerStats> stats(options.workers);
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (unsigned i = 0; i < options.workers; ++i)
+        workers.push_back(std::make_unique<Worker>(options, stats[i]));
+
+    unsigned total_hosts = 0;
+    for (size_t type = 0; type < panel_type_count; ++type)
+    {
+        if (!options.enabled[type])
+            continue;
+
+        for (unsigned index = 0; index < options.hosts_per_type; ++index)
+            workers[total_hosts++ % options.workers]->add_host(type, index);
+    }
+
+    if (total_hosts == 0)
+    {
+        fprintf(stderr, "No hosts to simulate\n");
+        return 1;
+    }
+
+    char rate[32] = "line rate";
+    if (options.rate > 0)
+        snprintf(rate, sizeof(rate), "%g Hz per host", options.rate);
+    printf("Simulating %u hosts against %s at %s with %u worker(s), batches of up to %u\n",
+           total_hosts, options.server_ip.c_str(), rate, options.workers, options.batch);
+
+    std::vector<std::thread> threads;
+    for (auto& worker : workers)
+    {
+        if (!worker->empty())
+            threads.emplace_back([&worker]() { worker->run(); });
+    }
+
+    // Report throughput once per second
+    uint64_t start = now_ns();
+    uint64_t last_packets = 0, last_bytes = 0;
+    for (unsigned second = 1; !stop_requested.load(); ++second)
+    {
+        sleep_until_ns(start + second * 1000000000ull);
+
+        uint64_t packets = 0, bytes = 0, errors = 0;
+        for (auto& s : stats)
+        {
+            packets += s.packets.load();
+            bytes += s.bytes.load();
+            errors += s.errors.load();
+        }
+
+        printf("%llu packets/s, %.2f Mbit/s, %llu packets total, %llu send errors\n",
+               (unsigned long long)(packets - last_packets), (bytes - last_bytes) * 8 / 1e6,
+               (unsigned long long)packets, (unsigned long long)errors);
+        fflush(stdout);
+        last_packets = packets;
+        last_bytes = bytes;
+
+        if (options.duration && second >= options.duration)
+            stop_requested.store(true);
+    }
+
+    for (auto& t : threads)
+        t.join();
+
+    return 0;
+}
@@ -2,6 +2,8 @@
 #include <ctime>
 #include <cstdarg>
 #include <cstdio>
+#include <cstdint>
+#include <string>
 
 #define INFO    "INF"
 #define ERROR   "ERR"
@@ -23,6 +25,19 @@ inline void log_message(const char* module, const char* level, const char* fmt,
     va_end(args);
 }
 
+// Formats a count with thousands separators, e.g. 1243 -> "1,243"
+inline std::string format_count(uint64_t count) {
+    std::string digits = std::to_string(count);
+    std::string result;
+    result.reserve(digits.size() + digits.size() / 3);
+    for (size_t i = 0; i < digits.size(); ++i) {
+        if (i > 0 && (digits.size() - i) % 3 == 0)
+            result += ',';
+        result += digits[i];
+    }
+    return result;
+}
+
 #define LOG_INFO(module, fmt, ...)  log_message(module, INFO, fmt, ##__VA_ARGS__)
 #define LOG_ERROR(module, fmt, ...) log_message(module, ERROR, fmt, ##__VA_ARGS__)
 
@@ -1,71 +1,358 @@
 #include "pdproxy.hpp"
 #include "amd64proxy.hpp"
 #include "netbsdvaxproxy.hpp"
+#include "linuxx64proxy.hpp"
 #include "webserver.hpp"
-#include <concepts>
+#include "relay.hpp"
+#include "config.hpp"
+#include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <list>
 #include <vector>
 #include <memory>
+#include <mutex>
 #include <csignal>
 #include <thread>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <arpa/inet.h>
 
-#define WEBSERVER_PORT 4080
-#define CONTENT_DIR "wwwroot"
-#define PDPROXY_NAME "pdproxy"
-#define PDPROXY_PORT 4000
-#define AMD64PROXY_NAME "amd64proxy"
-#define AMD64PROXY_PORT 4001
-#define NETBSDVAXPROXY_NAME "netbsdvax"
-#define NETBSDVAXPROXY_PORT 4002
+// A proxy with the configuration it was started with and the thread that runs it
+struct RunningProxy
+{
+    ProxyConfig config;
+    std::shared_ptr<ProxyBase> proxy;
+    std::thread thread;
+};
+
+// How the configuration was given, so that it can be read again on reload
+struct ConfigSource
+{
+    std::string file;
+    std::vector<std::string> overrides;
+    unsigned short web_port = 0;
+    std::string content_dir;
+};
 
-static std::vector<std::unique_ptr<ProxyBase>> proxies;
+// The relay client outlives the proxies that forward to it, the relay server does not outlive them
+static std::unique_ptr<RelayClient> relay_client;
+static std::mutex proxies_mutex;        // guards proxies, which relay links look up while reloads change them
+static std::list<RunningProxy> proxies;
 static std::unique_ptr<WebServer> webserver;
+static std::unique_ptr<RelayServer> relay_server;
+
+static ConfigSource config_source;
+static std::vector<std::string> multicast_groups;
+static std::mutex reload_mutex;         // serializes reloads, and guards running_config
+static Config running_config;
+
+// Set by the signal handler and acted upon by the main thread
+static volatile std::sig_atomic_t stop_requested = 0;
+static volatile std::sig_atomic_t reload_requested = 0;
 
-void signal_handler(int)
+void signal_handler(int signal)
 {
-    for (auto& proxy : proxies)
-        proxy->stop();
-    if (webserver)
-        webserver->stop();
+    if (signal == SIGHUP)
+        reload_requested = 1;
+    else
+        stop_requested = 1;
 }
 
-template<typename T>
-    requires std::derived_from<T, ProxyBase>
-void add_proxy(const std::string& name, unsigned short port)
+// One of proxy_types
+static std::unique_ptr<ProxyBase> create_proxy(const std::string& type, unsigned short port)
 {
-    webserver->add_proxy_port(name, port);
-    auto proxy = std::make_unique<T>(port);
-    proxies.push_back(std::move(proxy));
+    if (type == "pdp11")
+        return std::make_unique<PDProxy>(port);
+    if (type == "amd64")
+        return std::make_unique<AMD64Proxy>(port);
+    if (type == "netbsdvax")
+        return std::make_unique<NetBSDVAXProxy>(port);
+    if (type == "linuxx64")
+        return std::make_unique<LinuxX64Proxy>(port);
+    return nullptr;
+}
+
+// The file replaces the defaults, and the options change the result
+static bool read_config(Config& config, std::string& error)
+{
+    config = default_config();
+    if (!config_source.file.empty() && !load_config(config_source.file, config, error))
+        return false;
+    for (const auto& setting : config_source.overrides)
+    {
+        if (!override_config(config, setting, error))
+            return false;
+    }
+    if (config_source.web_port != 0)
+        config.web_port = config_source.web_port;
+    if (!config_source.content_dir.empty())
+        config.content_dir = config_source.content_dir;
+    return validate_config(config, error);
 }
 
-int main()
+static bool start_proxy(const ProxyConfig& config)
 {
+    std::shared_ptr<ProxyBase> proxy = create_proxy(config.type, config.port);
+    proxy->set_options(config.options);
+    proxy->set_multiplexer(&webserver->get_multiplexer(), config.name);
+
+    // Every proxy joins the groups on its own port, so one group can carry all panel types
+    for (const auto& group : multicast_groups)
+    {
+        size_t at = group.find('@');
+        bool joined = at == std::string::npos
+            ? proxy->join_multicast_group(group)
+            : proxy->join_multicast_group(group.substr(0, at), group.substr(at + 1));
+        if (!joined)
+            return false;
+    }
+
+    if (relay_client)
+        proxy->set_relay(relay_client.get());
+
+    webserver->add_proxy_port(config.name, config.port);
+
+    std::lock_guard guard(proxies_mutex);
+    auto& running = proxies.emplace_back(RunningProxy{config, proxy, {}});
+    running.thread = std::thread([proxy]() { proxy->run(); });
+    return true;
+}
+
+// Stops the proxies, disconnecting their WebSocket clients, and waits for them to finish
+static void stop_proxies(std::list<RunningProxy>& stopping)
+{
+    for (auto& running : stopping)
+    {
+        webserver->remove_proxy_port(running.config.name);
+        running.proxy->stop();
+    }
+    for (auto& running : stopping)
+    {
+        if (running.thread.joinable())
+            running.thread.join();
+    }
+}
+
+// Reads the configuration again and brings the proxies in line with it: proxies that were removed or
+// changed are stopped, new and changed ones are started, and the others keep running with their
+// clients and history. Returns a JSON summary of the changes, or false with error.
+static bool reload(std::string& result)
+{
+    std::lock_guard reload_guard(reload_mutex);
+
+    Config config;
+    std::string error;
+    if (!read_config(config, error))
+    {
+        log_message("Main", ERROR, "Not reloading, the configuration is not valid: %s", error.c_str());
+        crow::json::wvalue reply;
+        reply["error"] = error;
+        result = reply.dump();
+        return false;
+    }
+
+    if (config.web_port != running_config.web_port || config.content_dir != running_config.content_dir ||
+        config.web_threads != running_config.web_threads)
+        log_message("Main", ERROR, "Changes to the web settings take effect after a restart");
+
+    // Proxies stop first, so that a port they give up can be used by another one
+    std::list<RunningProxy> stopping;
+    crow::json::wvalue summary;
+    std::vector<crow::json::wvalue> stopped, started, unchanged;
+    {
+        std::lock_guard guard(proxies_mutex);
+        for (auto it = proxies.begin(); it != proxies.end();)
+        {
+            auto next = std::next(it);
+            if (std::find(config.proxies.begin(), config.proxies.end(), it->config) == config.proxies.end())
+            {
+                stopped.emplace_back(it->config.name);
+                stopping.splice(stopping.end(), proxies, it);
+            }
+            else
+                unchanged.emplace_back(it->config.name);
+            it = next;
+        }
+    }
+    stop_proxies(stopping);
+
+    for (const auto& proxy : config.proxies)
+    {
+        bool running;
+        {
+            std::lock_guard guard(proxies_mutex);
+            running = std::any_of(proxies.begin(), proxies.end(), [&](const RunningProxy& r) { return r.config == proxy; });
+        }
+        if (running)
+            continue;
+
+        if (start_proxy(proxy))
+            started.emplace_back(proxy.name);
+        else
+            log_message("Main", ERROR, "Failed to start proxy %s", proxy.name.c_str());
+    }
+
+    log_message("Main", INFO, "Reloaded the configuration: %zu proxies stopped, %zu started, %zu unchanged",
+            stopped.size(), started.size(), unchanged.size());
+
+    running_config = std::move(config);
+    summary["stopped"] = std::move(stopped);
+    summary["started"] = std::move(started);
+    summary["unchanged"] = std::move(unchanged);
+    result = summary.dump();
+    return true;
+}
+
+static void usage(const char* progname)
+{
+    printf("Usage: %s [-c file] [-o setting]... [-p port] [-w dir] [-g group[@interface]]... [-u host:port [-z]]\n", progname);
+    printf("       [-l [address:]port]\n");
+    printf("  -c file                read the proxies and their settings from a JSON file, see udproxy.json;\n");
+    printf("                         SIGHUP reads it again\n");
+    printf("  -o setting             change one setting of the file, or of the defaults: web.<key>=<value>\n");
+    printf("                         or <proxy name>.<key>=<value>, for example pdproxy.workers=2\n");
+    printf("  -p port                serve the web pages on this port (default: 4080)\n");
+    printf("  -g group[@interface]   also receive packets sent to this IPv4 multicast group, on the\n");
+    printf("                         interface with the given name or address (default: any)\n");
+    printf("  -u host:port           relay every accepted packet to the udproxy at host:port\n");
+    printf("  -z                     compress relayed packets with zlib\n");
+    printf("  -l [address:]port      accept relay links from other udproxy instances on this TCP port,\n");
+    printf("                         on all interfaces unless an address is given; links are not authenticated\n");
+    printf("  -w dir                 serve the web content from this directory instead of the copy built\n");
+    printf("                         into udproxy, and pick up changes to it (for development)\n");
+    printf("  -h                     Show this help\n");
+}
+
+int main(int argc, char* argv[])
+{
+    std::string upstream;
+    bool compress = false;
+    std::string relay_listen;
+    int c;
+
+    while ((c = getopt(argc, argv, "c:o:p:g:u:zl:w:h")) != -1)
+    {
+        switch (c)
+        {
+        case 'c': config_source.file = optarg; break;
+        case 'o': config_source.overrides.push_back(optarg); break;
+        case 'p': config_source.web_port = (unsigned short)atoi(optarg); break;
+        case 'g': multicast_groups.push_back(optarg); break;
+        case 'u': upstream = optarg; break;
+        case 'z': compress = true; break;
+        case 'l': relay_listen = optarg; break;
+        case 'w': config_source.content_dir = optarg; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    std::string error;
+    if (!read_config(running_config, error))
+    {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+
+    if (!upstream.empty())
+    {
+        size_t colon = upstream.rfind(':');
+        if (colon == std::string::npos || colon == 0)
+        {
+            fprintf(stderr, "Expected host:port: %s\n", upstream.c_str());
+            return 1;
+        }
+        relay_client = std::make_unique<RelayClient>(upstream.substr(0, colon),
+                (unsigned short)atoi(upstream.c_str() + colon + 1), compress);
+    }
+
+    in_addr relay_address{htonl(INADDR_ANY)};
+    unsigned short relay_port = 0;
+    if (!relay_listen.empty())
+    {
+        size_t colon = relay_listen.rfind(':');
+        if (colon != std::string::npos && inet_pton(AF_INET, relay_listen.substr(0, colon).c_str(), &relay_address) != 1)
+        {
+            fprintf(stderr, "Expected [address:]port with an IPv4 address: %s\n", relay_listen.c_str());
+            return 1;
+        }
+        relay_port = (unsigned short)atoi(relay_listen.c_str() + (colon == std::string::npos ? 0 : colon + 1));
+    }
+
     std::signal(SIGINT, signal_handler);
+    std::signal(SIGTERM, signal_handler);
+    std::signal(SIGHUP, signal_handler);
 
     // Create shared webserver
-    webserver = std::make_unique<WebServer>(WEBSERVER_PORT, CONTENT_DIR);
+    webserver = std::make_unique<WebServer>(running_config.web_port, running_config.content_dir);
+    webserver->set_threads(running_config.web_threads);
+    webserver->set_reload_handler(reload);
 
-    add_proxy<PDProxy>(PDPROXY_NAME, PDPROXY_PORT);
-    add_proxy<AMD64Proxy>(AMD64PROXY_NAME, AMD64PROXY_PORT);
-    add_proxy<NetBSDVAXProxy>(NETBSDVAXPROXY_NAME, NETBSDVAXPROXY_PORT);
-    // Example: add more proxies with different ports if needed
-    // add_proxy("proxy2", 5000);
+    if (relay_client)
+        relay_client->start();
+
+    // Run all proxies in parallel
+    for (const auto& proxy : running_config.proxies)
+    {
+        if (!start_proxy(proxy))
+        {
+            stop_proxies(proxies);
+            return 1;
+        }
+    }
+
+    // Datagrams relayed from downstream go to the first proxy for their panel type, as if received locally
+    if (relay_port != 0)
+    {
+        relay_server = std::make_unique<RelayServer>(relay_address, relay_port, [](panel_type type) -> std::shared_ptr<ProxyBase>
+        {
+            std::lock_guard guard(proxies_mutex);
+            for (auto& running : proxies)
+            {
+                if (running.proxy->handled_type() == type)
+                    return running.proxy;
+            }
+            return nullptr;
+        });
+        relay_server->start();
+    }
 
     auto webserver_thread = std::thread([]() { webserver->run(); });
 
-    // Run all proxies in parallel
-    std::vector<std::thread> threads;
-    for (auto& proxy : proxies)
-        threads.emplace_back([&proxy]() { proxy->run(); });
+    // Signals only set flags, the work is done here
+    while (!stop_requested)
+    {
+        if (reload_requested)
+        {
+            reload_requested = 0;
+            std::string result;
+            reload(result);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
 
-    for (auto& t : threads)
     {
-        if (t.joinable())
-            t.join();
+        std::lock_guard reload_guard(reload_mutex);
+        std::list<RunningProxy> stopping;
+        {
+            std::lock_guard guard(proxies_mutex);
+            stopping.splice(stopping.end(), proxies);
+        }
+        stop_proxies(stopping);
     }
 
+    webserver->stop();
     if (webserver_thread.joinable())
         webserver_thread.join();
 
+    if (relay_server)
+        relay_server->stop();
+    if (relay_client)
+        relay_client->stop();
+
     return 0;
 }
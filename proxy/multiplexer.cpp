@@ -0,0 +1,247 @@
+#include "multiplexer.hpp"
+#include <algorithm>
+
+namespace
+{
+    // Reads an optional unsigned integer member no larger than max; false if it is present but not one
+    bool get_unsigned(const crow::json::rvalue& object, const char* key, uint64_t max, std::optional<uint64_t>& value)
+    {
+        value.reset();
+        if (!object.has(key))
+            return true;
+
+        const crow::json::rvalue& member = object[key];
+        if (member.t() != crow::json::type::Number || member.nt() != crow::json::num_type::Unsigned_integer ||
+            member.u() > max)
+            return false;
+
+        value = member.u();
+        return true;
+    }
+
+    void send_error(crow::websocket::connection& conn, std::optional<uint64_t> id, const std::string& error)
+    {
+        std::string reply = "{";
+        if (id)
+            reply += "\"sub\":" + std::to_string(*id) + ",";
+        conn.send_text(reply + "\"error\":\"" + error + "\"}");
+    }
+}
+
+StreamMultiplexer::StreamMultiplexer()
+{
+    flusher = std::thread([&]() { flush_loop(); });
+}
+
+StreamMultiplexer::~StreamMultiplexer()
+{
+    {
+        std::lock_guard guard(mutex);
+        stop_requested = true;
+    }
+    wakeup.notify_all();
+    if (flusher.joinable())
+        flusher.join();
+}
+
+void StreamMultiplexer::add_proxy(const std::string& name)
+{
+    std::lock_guard guard(mutex);
+    proxies.insert(name);
+}
+
+void StreamMultiplexer::remove_proxy(const std::string& name)
+{
+    std::lock_guard guard(mutex);
+    proxies.erase(name);
+}
+
+void StreamMultiplexer::open(crow::websocket::connection& conn)
+{
+    std::lock_guard guard(mutex);
+    sessions[&conn];
+}
+
+void StreamMultiplexer::close(crow::websocket::connection& conn)
+{
+    std::lock_guard guard(mutex);
+    sessions.erase(&conn);
+}
+
+void StreamMultiplexer::message(crow::websocket::connection& conn, const std::string& data)
+{
+    auto request = crow::json::load(data);
+    if (!request || request.t() != crow::json::type::Object)
+    {
+        send_error(conn, std::nullopt, "expected a JSON object");
+        return;
+    }
+
+    std::lock_guard guard(mutex);
+    if (request.has("subscribe"))
+        subscribe(conn, request);
+    else if (request.has("unsubscribe"))
+        unsubscribe(conn, request);
+    else
+        send_error(conn, std::nullopt, "expected subscribe or unsubscribe");
+}
+
+void StreamMultiplexer::subscribe(crow::websocket::connection& conn, const crow::json::rvalue& request)
+{
+    std::optional<uint64_t> id, host, cpu, rate;
+    if (!get_unsigned(request, "subscribe", UINT64_MAX, id))
+    {
+        send_error(conn, std::nullopt, "invalid subscription id");
+        return;
+    }
+
+    if (!request.has("proxy") || request["proxy"].t() != crow::json::type::String ||
+        !proxies.contains(request["proxy"].s()))
+    {
+        send_error(conn, id, "unknown proxy");
+        return;
+    }
+
+    if (!get_unsigned(request, "host", UINT32_MAX, host) || !get_unsigned(request, "cpu", UINT16_MAX, cpu))
+    {
+        send_error(conn, id, "invalid host or cpu");
+        return;
+    }
+
+    // The same bounds as the ?rate= of a proxy's own WebSocket
+    if (!get_unsigned(request, "rate", RateCap::max_rate, rate))
+    {
+        send_error(conn, id, "invalid rate");
+        return;
+    }
+    clock::duration interval = rate && *rate > 0 ? clock::duration(std::chrono::seconds(1)) / int(*rate) : clock::duration::zero();
+
+    // Subscribing with an id that is in use changes that subscription
+    auto& subscriptions = sessions[&conn];
+    auto it = std::find_if(subscriptions.begin(), subscriptions.end(), [&](const Subscription& s) { return s.id == *id; });
+    if (it == subscriptions.end())
+    {
+        if (subscriptions.size() >= max_subscriptions)
+        {
+            send_error(conn, id, "too many subscriptions");
+            return;
+        }
+        it = subscriptions.emplace(subscriptions.end());
+    }
+
+    it->id = *id;
+    it->proxy = request["proxy"].s();
+    it->host = host ? std::optional<uint32_t>(uint32_t(*host)) : std::nullopt;
+    it->cpu = cpu ? std::optional<uint16_t>(uint16_t(*cpu)) : std::nullopt;
+    it->interval = interval;
+    it->caps.clear();
+
+    conn.send_text("{\"subscribed\":" + std::to_string(*id) + "}");
+}
+
+void StreamMultiplexer::unsubscribe(crow::websocket::connection& conn, const crow::json::rvalue& request)
+{
+    std::optional<uint64_t> id;
+    auto& subscriptions = sessions[&conn];
+    if (!get_unsigned(request, "unsubscribe", UINT64_MAX, id) ||
+        std::erase_if(subscriptions, [&](const Subscription& s) { return s.id == *id; }) == 0)
+    {
+        send_error(conn, id, "unknown subscription");
+        return;
+    }
+
+    conn.send_text("{\"unsubscribed\":" + std::to_string(*id) + "}");
+}
+
+void StreamMultiplexer::publish(const std::string& proxy, uint32_t host_id, uint16_t cpu, uint32_t seq,
+        uint32_t timestamp, const std::string& json)
+{
+    std::lock_guard guard(mutex);
+
+    // Everything after the subscription id, built when the first subscription matches
+    std::string body;
+    clock::time_point now;
+
+    for (auto& [conn, subscriptions] : sessions)
+    {
+        for (auto& subscription : subscriptions)
+        {
+            if (subscription.proxy != proxy || (subscription.host && *subscription.host != host_id) ||
+                (subscription.cpu && *subscription.cpu != cpu))
+                continue;
+
+            if (body.empty())
+            {
+                body = ",\"proxy\":\"" + proxy + "\",\"host\":" + std::to_string(host_id) +
+                       ",\"cpu\":" + std::to_string(cpu) + ",\"seq\":" + std::to_string(seq) +
+                       ",\"timestamp\":" + std::to_string(timestamp) + ",\"state\":" + json + '}';
+                now = clock::now();
+            }
+
+            std::string frame = "{\"sub\":" + std::to_string(subscription.id) + body;
+            if (subscription.interval == clock::duration::zero())
+            {
+                conn->send_text(frame);
+                continue;
+            }
+
+            RateCap& cap = subscription.caps[(uint64_t(host_id) << 16) | cpu];
+            if (cap.open(now))
+            {
+                conn->send_text(frame);
+                cap.sent(now, subscription.interval);
+                continue;
+            }
+
+            if (cap.hold(frame))
+                conflated[proxy]++;
+            if (cap.due() < next_flush)
+            {
+                next_flush = cap.due();
+                wakeup.notify_one();
+            }
+        }
+    }
+}
+
+uint64_t StreamMultiplexer::conflated_samples(const std::string& proxy)
+{
+    std::lock_guard guard(mutex);
+    auto it = conflated.find(proxy);
+    return it == conflated.end() ? 0 : it->second;
+}
+
+void StreamMultiplexer::flush_loop()
+{
+    std::unique_lock lock(mutex);
+    while (!stop_requested)
+    {
+        if (next_flush == clock::time_point::max())
+            wakeup.wait(lock);
+        else
+            wakeup.wait_until(lock, next_flush);
+
+        // Send the conflated samples that are due, and find out when the next one is
+        auto now = clock::now();
+        next_flush = clock::time_point::max();
+        for (auto& [conn, subscriptions] : sessions)
+        {
+            for (auto& subscription : subscriptions)
+            {
+                for (auto& [key, cap] : subscription.caps)
+                {
+                    if (!cap.holding())
+                        continue;
+
+                    if (cap.open(now))
+                    {
+                        conn->send_text(cap.held_sample());
+                        cap.sent(now, subscription.interval);
+                    }
+                    else
+                        next_flush = std::min(next_flush, cap.due());
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "logging.hpp"
+#include "ratecap.hpp"
+#define CROW_ENABLE_COMPRESSION 1
+#include "crow_all.h"
+
+// Serves the samples of any number of proxies, hosts and CPUs over a single WebSocket. A client
+// subscribes to streams with JSON messages:
+//
+//   {"subscribe":1,"proxy":"netbsdvax","host":33554432,"cpu":0,"rate":10}
+//   {"unsubscribe":1}
+//
+// where the id is chosen by the client, "host" and "cpu" are optional and match every host or CPU if
+// left out, and "rate" optionally caps the samples per second of each matching host and CPU, at most
+// RateCap::max_rate, or 0 for no cap. Samples that come in faster than that are conflated: only the
+// most recent one is sent once the cap allows.
+// Every sample is sent as {"sub":1,"proxy":...,"host":...,"cpu":...,"seq":...,"state":{...}}.
+class StreamMultiplexer : public Loggable
+{
+public:
+    StreamMultiplexer();
+    ~StreamMultiplexer();
+    const char* module_name() const override { return "Multiplexer"; }
+
+    // Makes the samples of the named proxy available for subscription
+    void add_proxy(const std::string& name);
+    // Makes them unavailable for new subscriptions; existing ones resume if a proxy of that name is added again
+    void remove_proxy(const std::string& name);
+
+    // Called by the WebSocket route
+    void open(crow::websocket::connection& conn);
+    void close(crow::websocket::connection& conn);
+    void message(crow::websocket::connection& conn, const std::string& data);
+
+    // Called by the proxies for every sample they publish
+    void publish(const std::string& proxy, uint32_t host_id, uint16_t cpu, uint32_t seq, uint32_t timestamp,
+            const std::string& json);
+    // Samples of the named proxy that a rate cap replaced with a newer one before they were sent
+    uint64_t conflated_samples(const std::string& proxy);
+
+private:
+    using clock = RateCap::clock;
+
+    static constexpr size_t max_subscriptions = 1024;      // per connection
+
+    struct Subscription
+    {
+        uint64_t id;
+        std::string proxy;
+        std::optional<uint32_t> host;
+        std::optional<uint16_t> cpu;
+        clock::duration interval;       // zero if uncapped
+        std::unordered_map<uint64_t, RateCap> caps;     // by host id and CPU
+    };
+
+    void subscribe(crow::websocket::connection& conn, const crow::json::rvalue& request);
+    void unsubscribe(crow::websocket::connection& conn, const crow::json::rvalue& request);
+    void flush_loop();
+
+    std::set<std::string> proxies;
+    std::thread flusher;
+    std::mutex mutex;                   // guards everything below
+    std::condition_variable wakeup;
+    bool stop_requested = false;
+    clock::time_point next_flush = clock::time_point::max();   // when the first held sample is due
+    std::map<crow::websocket::connection*, std::vector<Subscription>> sessions;
+    std::map<std::string, uint64_t> conflated;     // by proxy
+};
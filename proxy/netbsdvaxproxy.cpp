@@ -1,23 +1,6 @@
 #include "netbsdvaxproxy.hpp"
 #include <cstring>
 
-// Packet structure definitions - use tight packing to match network protocol
-#pragma pack(push, 1)
-
-struct netbsdvax_panel_state
-{
-    uint32_t ps_address;    /* panel switches - 32-bit address */
-    uint32_t ps_data;       /* panel lamps - 32-bit data */
-};
-
-struct netbsdvax_panel_packet
-{
-    panel_packet_header header;
-    netbsdvax_panel_state panel_state;
-};
-
-#pragma pack(pop)
-
 NetBSDVAXProxy::NetBSDVAXProxy(unsigned short port)
     : ProxyBase(port)
 {
@@ -26,7 +9,7 @@ NetBSDVAXProxy::NetBSDVAXProxy(unsigned short port)
              sizeof(panel_packet_header), sizeof(netbsdvax_panel_state), sizeof(netbsdvax_panel_packet));
 }
 
-std::string NetBSDVAXProxy::udp_packet_to_json(std::span<const char> data)
+std::string NetBSDVAXProxy::panel_state_to_json(std::span<const char> data)
 {
     // Parse the NetBSD VAX panel state
     netbsdvax_panel_state panel_state;
@@ -39,3 +22,20 @@ std::string NetBSDVAXProxy::udp_packet_to_json(std::span<const char> data)
 
     return json.dump();
 }
+
+std::span<const LampRegister> NetBSDVAXProxy::lamp_registers() const
+{
+    static constexpr LampRegister registers[] = {{"address", 32}, {"data", 32}};
+    return registers;
+}
+
+bool NetBSDVAXProxy::panel_lamps(std::span<const char> data, PanelLamps& lamps)
+{
+    netbsdvax_panel_state panel_state;
+    if (!get_panel_state(data, panel_state))
+        return false;
+
+    lamps.words[0] = panel_state.ps_address;
+    lamps.words[1] = panel_state.ps_data;
+    return true;
+}
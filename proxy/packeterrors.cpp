@@ -0,0 +1,87 @@
+#include "packeterrors.hpp"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <algorithm>
+#include <string>
+
+namespace
+{
+    const char* reason_text(PacketError reason)
+    {
+        switch (reason)
+        {
+            case PacketError::TooSmallForHeader:    return "too small for header, size";
+            case PacketError::Truncated:            return "truncated, size";
+            case PacketError::PayloadSizeMismatch:  return "payload size";
+            case PacketError::UnsupportedVersion:   return "protocol version";
+            case PacketError::MalformedBatch:       return "malformed batch, size";
+            default:                                return "unparseable, size";
+        }
+    }
+}
+
+PacketErrorReporter::PacketErrorReporter(const Loggable& owner)
+    : owner(owner)
+    , next_summary(clock::now() + summary_interval)
+{
+}
+
+void PacketErrorReporter::report(uint32_t source_addr, const PacketRejection& rejection, clock::time_point now)
+{
+    auto& bucket = buckets[Key{source_addr, rejection.reason}];
+
+    // Refill the bucket for the time that passed since the last rejection for this key
+    if (bucket.last_seen != clock::time_point{})
+    {
+        std::chrono::duration<double> elapsed = now - bucket.last_seen;
+        bucket.tokens = std::min(bucket_capacity, bucket.tokens + elapsed.count() * tokens_per_second);
+    }
+
+    bucket.last_seen = now;
+    bucket.last = rejection;
+
+    if (bucket.tokens >= 1.0)
+    {
+        bucket.tokens -= 1.0;
+        log_rejection("Packet", source_addr, rejection);
+    }
+    else
+        bucket.suppressed++;
+}
+
+void PacketErrorReporter::summarize(clock::time_point now)
+{
+    next_summary = now + summary_interval;
+
+    for (auto it = buckets.begin(); it != buckets.end();)
+    {
+        auto& bucket = it->second;
+
+        if (bucket.suppressed > 0)
+        {
+            std::string prefix = format_count(bucket.suppressed) + (bucket.suppressed == 1 ? " packet" : " packets");
+            log_rejection(prefix.c_str(), it->first.source_addr, bucket.last);
+            bucket.suppressed = 0;
+        }
+
+        // Forget sources that stopped sending bad packets a while ago
+        if (now - bucket.last_seen > idle_expiry)
+            it = buckets.erase(it);
+        else
+            ++it;
+    }
+}
+
+void PacketErrorReporter::log_rejection(const char* prefix, uint32_t source_addr, const PacketRejection& rejection) const
+{
+    char address[INET_ADDRSTRLEN];
+    in_addr addr{};
+    addr.s_addr = source_addr;
+    inet_ntop(AF_INET, &addr, address, sizeof(address));
+
+    if (rejection.expected == 0)
+        owner.log_error("%s from %s rejected: %s %u", prefix, address, reason_text(rejection.reason), rejection.size);
+    else
+        owner.log_error("%s from %s rejected: %s %u expected %u",
+                prefix, address, reason_text(rejection.reason), rejection.size, rejection.expected);
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <cstdint>
+#include <chrono>
+#include <unordered_map>
+#include "logging.hpp"
+
+// Reasons a datagram can be rejected by the ingest path
+enum class PacketError : uint8_t
+{
+    None,
+    TooSmallForHeader,
+    Truncated,
+    PayloadSizeMismatch,
+    UnsupportedVersion,
+    MalformedBatch,
+};
+
+// Cheap, unformatted description of a rejected datagram. The ingest path only fills this in;
+// turning it into text is left to PacketErrorReporter, which does so at a bounded rate.
+struct PacketRejection
+{
+    PacketError reason = PacketError::None;
+    uint32_t size = 0;          // bytes that were received/announced, or the version
+    uint32_t expected = 0;      // bytes that were required, or the highest supported version
+};
+
+// Rate-limited, aggregated logging of rejected packets. Each (source address, reason) pair gets a
+// token bucket: the first few rejections are logged right away, after which they are only counted
+// and summarized once every summary interval.
+class PacketErrorReporter
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    explicit PacketErrorReporter(const Loggable& owner);
+
+    // Record a rejected packet; only formats a log line if the bucket for this key has a token left
+    void report(uint32_t source_addr, const PacketRejection& rejection, clock::time_point now);
+
+    // Emit summaries for suppressed rejections if the summary interval has passed
+    void flush(clock::time_point now)
+    {
+        if (now >= next_summary)
+            summarize(now);
+    }
+
+private:
+    static constexpr double bucket_capacity = 5.0;              // lines logged immediately per key
+    static constexpr double tokens_per_second = 0.1;            // sustained immediate lines per key
+    static constexpr auto summary_interval = std::chrono::seconds(10);
+    static constexpr auto idle_expiry = std::chrono::minutes(5);
+
+    struct Key
+    {
+        uint32_t source_addr;
+        PacketError reason;
+
+        bool operator==(const Key&) const = default;
+    };
+
+    struct KeyHash
+    {
+        size_t operator()(const Key& key) const
+        {
+            return std::hash<uint64_t>{}((uint64_t(key.source_addr) << 8) | uint64_t(key.reason));
+        }
+    };
+
+    struct Bucket
+    {
+        double tokens = bucket_capacity;
+        clock::time_point last_seen;
+        uint64_t suppressed = 0;
+        PacketRejection last;       // most recent rejection, used in the summary
+    };
+
+    void summarize(clock::time_point now);
+    void log_rejection(const char* prefix, uint32_t source_addr, const PacketRejection& rejection) const;
+
+    const Loggable& owner;
+    std::unordered_map<Key, Bucket, KeyHash> buckets;
+    clock::time_point next_summary;
+};
@@ -1,28 +1,6 @@
 #include "pdproxy.hpp"
 #include <cstring>
 
-// Packet structure definitions - use tight packing to match network protocol
-#pragma pack(push, 1)
-
-struct pdp_panel_state
-{
-    uint32_t ps_address;    /* panel switches - 32-bit address */
-    uint16_t ps_data;       /* panel lamps - 16-bit data */
-    uint16_t ps_psw;        /* processor status word */
-    uint16_t ps_mser;       /* machine status register */
-    uint16_t ps_cpu_err;    /* CPU error register */
-    uint16_t ps_mmr0;       /* memory management register 0 */
-    uint16_t ps_mmr3;       /* memory management register 3 */
-};
-
-struct pdp_panel_packet
-{
-    panel_packet_header header;
-    pdp_panel_state panel_state;
-};
-
-#pragma pack(pop)
-
 PDProxy::PDProxy(unsigned short port)
     : ProxyBase(port)
 {
@@ -31,7 +9,7 @@ PDProxy::PDProxy(unsigned short port)
              sizeof(panel_packet_header), sizeof(pdp_panel_state), sizeof(pdp_panel_packet));
 }
 
-std::string PDProxy::udp_packet_to_json(std::span<const char> data)
+std::string PDProxy::panel_state_to_json(std::span<const char> data)
 {
     // Parse the PDP panel state
     pdp_panel_state panel_state;
@@ -68,3 +46,20 @@ std::string PDProxy::udp_packet_to_json(std::span<const char> data)
 
     return json.dump();
 }
+
+std::span<const LampRegister> PDProxy::lamp_registers() const
+{
+    static constexpr LampRegister registers[] = {{"address", 22}, {"data", 16}};
+    return registers;
+}
+
+bool PDProxy::panel_lamps(std::span<const char> data, PanelLamps& lamps)
+{
+    pdp_panel_state panel_state;
+    if (!get_panel_state(data, panel_state))
+        return false;
+
+    lamps.words[0] = panel_state.ps_address & 0x3fffff;
+    lamps.words[1] = panel_state.ps_data;
+    return true;
+}
@@ -6,6 +6,9 @@ class PDProxy : public ProxyBase
 public:
     PDProxy(unsigned short port);
     ~PDProxy() override = default;
-    std::string udp_packet_to_json(std::span<const char> data) override;
+    std::string panel_state_to_json(std::span<const char> data) override;
+    panel_type handled_type() const override { return PANEL_PDP1170; }
+    std::span<const LampRegister> lamp_registers() const override;
+    bool panel_lamps(std::span<const char> data, PanelLamps& lamps) override;
     const char* module_name() const override { return "PDProxy"; }
 };
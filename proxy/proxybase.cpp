@@ -1,36 +1,161 @@
 #include "proxybase.hpp"
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
+#include <ifaddrs.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <sys/time.h>
 #include <cstring>
+#include <cstdlib>
+#include <algorithm>
 #include <chrono>
+#include <optional>
+#include <cstdio>
+#include <pthread.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
 
 ProxyBase::ProxyBase(unsigned short port)
     : port(port)
 {
     ws_server.loglevel(crow::LogLevel::Warning); // Set log level to Warning
+    ws_server.signal_clear();   // main handles the signals, and stops the proxies in order
 
+    // Clients get the samples of every host and CPU, or only those of one host with ?host= and of one
+    // CPU with ?cpu=. With ?rate= they get at most that many samples per second, the newest ones, and
+    // with ?activity=1 as well what the lamps did in the samples in between. With ?glow=1 the samples
+    // carry how brightly each lamp glows.
     CROW_WEBSOCKET_ROUTE(ws_server, "/")
+    .onaccept([&](const crow::request& req, void** userdata)
+    {
+        ClientFilter filter{stream_filter(req), cpu_filter(req)};
+        int rate = rate_filter(req);
+        if (filter.stream == invalid_stream || filter.cpu == invalid_cpu || rate == invalid_rate)
+            return false;
+
+        if (rate > 0)
+            filter.interval = std::chrono::duration_cast<PacketErrorReporter::clock::duration>(std::chrono::seconds(1)) / rate;
+        const char* activity = req.url_params.get("activity");
+        filter.activity = activity && strcmp(activity, "0") != 0;
+        const char* glow = req.url_params.get("glow");
+        filter.glow = glow && strcmp(glow, "0") != 0;
+
+        // Crow keeps this with the connection, and opens it right after accepting it, which takes it back
+        *userdata = new ClientFilter(filter);
+        return true;
+    })
     .onopen([&](crow::websocket::connection& conn)
     {
+        std::unique_ptr<ClientFilter> filter(static_cast<ClientFilter*>(conn.userdata()));
+        conn.userdata(nullptr);
+        if (!filter)
+        {
+            conn.close("not accepted");
+            return;
+        }
+
         {
             std::lock_guard guard(ws_clients_mutex);
-            ws_clients.insert(&conn);
+            Client& client = ws_clients[&conn];
+            client.conn = &conn;
+            client.filter = *filter;
+
+            // Show the current state right away rather than at the next packet. A stream that has not
+            // been heard from yet gets its subscriber when its first sample arrives.
+            const SampleHistory::Sample* sample = nullptr;
+            if (client.filter.stream == all_streams)
+                sample = history.latest(client.filter.cpu);
+            else if (auto* stream = streams.find(client.filter.stream); stream && *stream)
+            {
+                (*stream)->subscribers.push_back(&client);
+                sample = (*stream)->history.latest(client.filter.cpu);
+            }
+            else
+                unheard_subscribers[client.filter.stream].push_back(&client);
+            if (sample)
+                conn.send_text(sample->json);
         }
 
         log_info("WebSocket client connected: %s", conn.get_remote_ip().c_str());
     })
     .onclose([&](crow::websocket::connection& conn, const std::string&, uint16_t)
     {
-        std::lock_guard guard(ws_clients_mutex);
-        ws_clients.erase(&conn);
+        remove_client(conn);
     })
     .onerror([&](crow::websocket::connection& conn, const std::string& msg)
     {
-        log_error("WebSocket error from %s: %s", conn.get_remote_ip().c_str(), msg.c_str());
-        std::lock_guard guard(ws_clients_mutex);
-        ws_clients.erase(&conn);
+        // The socket may be gone already, so its address cannot be asked for here
+        remove_client(conn);
+        log_error("WebSocket error: %s", msg.c_str());
+    });
+
+    // Recent samples, including all samples of batched packets; ?n= limits the count, ?host= selects a
+    // stream and ?cpu= a CPU
+    CROW_ROUTE(ws_server, "/history")
+    ([&](const crow::request& req)
+    {
+        size_t limit = history_capacity;
+        if (const char* n = req.url_params.get("n"))
+            limit = strtoul(n, nullptr, 10);
+
+        int cpu = cpu_filter(req);
+        uint64_t key = stream_filter(req);
+        if (cpu == invalid_cpu || key == invalid_stream)
+            return crow::response(400);
+
+        crow::response response;
+        {
+            std::lock_guard guard(ws_clients_mutex);
+            if (key == all_streams)
+                response.body = history.to_json(limit, cpu);
+            else if (const auto* stream = streams.find(key); stream && *stream)
+                response.body = (*stream)->history.to_json(limit, cpu);
+            else
+                response.body = "{\"samples\":[]}";
+        }
+        response.set_header("Content-Type", "application/json");
+        return response;
+    });
+
+    // The hosts that sent to this proxy recently, with their sample rates
+    CROW_ROUTE(ws_server, "/streams.json")
+    ([&]
+    {
+        crow::response response;
+        {
+            std::lock_guard guard(ws_clients_mutex);
+            response.body = streams_to_json(PacketErrorReporter::clock::now());
+        }
+        response.set_header("Content-Type", "application/json");
+        return response;
+    });
+
+    // How long datagrams took from arriving to being handed to the WebSocket clients, and how many
+    // were lost on the way: dropped by the kernel, or conflated by the rate caps of the WebSocket clients
+    // and of the multiplexer's subscriptions
+    CROW_ROUTE(ws_server, "/metrics.json")
+    ([&]
+    {
+        crow::response response;
+        {
+            std::lock_guard guard(metrics_mutex);
+            response.body = "{\"ingest\":" + ingest_stats.to_json() +
+                ",\"receive_buffer\":" + std::to_string(receive_buffer_size) +
+                ",\"kernel_drops\":" + std::to_string(total_kernel_drops());
+        }
+        uint64_t conflated_samples;
+        {
+            std::lock_guard guard(ws_clients_mutex);
+            conflated_samples = conflated;
+        }
+        if (multiplexer)
+            conflated_samples += multiplexer->conflated_samples(multiplexer_name);
+        response.body += ",\"conflated\":" + std::to_string(conflated_samples) + '}';
+        response.set_header("Content-Type", "application/json");
+        return response;
     });
 }
 
@@ -38,40 +163,224 @@ ProxyBase::~ProxyBase()
 {
     ws_server.stop();
     stop_requested.store(true);
-    if (udp_thread.joinable())
-        udp_thread.join();
+    for (auto& thread : udp_threads)
+    {
+        if (thread.joinable())
+            thread.join();
+    }
+    stop_flusher();
 }
 
 void ProxyBase::run()
 {
     log_info("Starting WebSocket server on port %u", port);
-    server_future = ws_server.port(port).multithreaded().run_async();
-    if (ws_server.wait_for_server_start() != std::cv_status::no_timeout)
+    ws_server.port(port).multithreaded();
+    if (options.threads > 0)
+        ws_server.concurrency(uint16_t(options.threads));
+
+    // Crow's threads, which send to the WebSocket clients, take the CPUs of the thread that starts them
+#ifdef __linux__
+    cpu_set_t original_cpus;
+    bool restore_cpus = !options.fanout_cpus.empty() &&
+        pthread_getaffinity_np(pthread_self(), sizeof(original_cpus), &original_cpus) == 0;
+#endif
+    set_cpu_affinity(options.fanout_cpus, "WebSocket");
+    server_future = ws_server.run_async();
+    auto started = ws_server.wait_for_server_start();
+#ifdef __linux__
+    if (restore_cpus)
+        pthread_setaffinity_np(pthread_self(), sizeof(original_cpus), &original_cpus);
+#endif
+
+    if (started != std::cv_status::no_timeout)
     {
         log_error("Failed to start WebSocket server on port %u", port);
         return;
     }
 
     log_info("WebSocket server started");
+    if (stop_requested.load())
+        ws_server.stop();
 
-    udp_thread = std::thread([&]() { udp_loop(); });
+#ifndef IP_MULTICAST_ALL
+    // Every socket on the port would get a copy of each multicast packet, see udp_loop
+    if (!multicast_groups.empty() && options.workers > 1)
+    {
+        log_error("Multicast groups cannot be shared by %u workers on this system; using one", options.workers);
+        options.workers = 1;
+    }
+#endif
+    {
+        std::lock_guard guard(metrics_mutex);
+        kernel_drops.assign(options.workers, 0);
+    }
+    flusher = std::thread([this]() { flush_loop(); });
+    for (unsigned worker = 0; worker < options.workers; worker++)
+        udp_threads.emplace_back([this, worker]() { udp_loop(worker); });
 
     server_future.wait();
     log_info("WebSocket server stopped");
 
     stop_requested.store(true);
-    if (udp_thread.joinable())
-        udp_thread.join();
+    for (auto& thread : udp_threads)
+    {
+        if (thread.joinable())
+            thread.join();
+    }
+    stop_flusher();
+}
+
+void ProxyBase::stop_flusher()
+{
+    // Under the lock, so that the flusher is either waiting or sees stop_requested
+    {
+        std::lock_guard guard(ws_clients_mutex);
+        flush_wakeup.notify_all();
+    }
+    if (flusher.joinable())
+        flusher.join();
 }
 
 void ProxyBase::stop()
 {
-    ws_server.stop();
+    // Set first, so that run() stops the server itself if it was not running yet
     stop_requested.store(true);
+    ws_server.stop();
 }
 
-void ProxyBase::udp_loop()
+bool ProxyBase::join_multicast_group(const std::string& group, const std::string& interface)
 {
+    MulticastGroup entry{};
+    entry.name = interface.empty() ? group : group + " on " + interface;
+    entry.interface.s_addr = htonl(INADDR_ANY);
+
+    if (inet_pton(AF_INET, group.c_str(), &entry.group) != 1 || !IN_MULTICAST(ntohl(entry.group.s_addr)))
+    {
+        log_error("Not an IPv4 multicast group: %s", group.c_str());
+        return false;
+    }
+
+    // The interface is given by address, or by name, which is resolved to its first IPv4 address
+    if (!interface.empty() && inet_pton(AF_INET, interface.c_str(), &entry.interface) != 1)
+    {
+        ifaddrs* interfaces = nullptr;
+        bool found = false;
+        if (getifaddrs(&interfaces) == 0)
+        {
+            for (ifaddrs* it = interfaces; it && !found; it = it->ifa_next)
+            {
+                if (it->ifa_addr && it->ifa_addr->sa_family == AF_INET && interface == it->ifa_name)
+                {
+                    entry.interface = reinterpret_cast<sockaddr_in*>(it->ifa_addr)->sin_addr;
+                    found = true;
+                }
+            }
+            freeifaddrs(interfaces);
+        }
+
+        if (!found)
+        {
+            log_error("No IPv4 interface %s to join multicast group %s on", interface.c_str(), group.c_str());
+            return false;
+        }
+    }
+
+    multicast_groups.push_back(entry);
+    return true;
+}
+
+// Applies to the calling thread, and to the threads it starts afterwards
+void ProxyBase::set_cpu_affinity(const std::vector<int>& cpus, const char* threads)
+{
+    if (cpus.empty())
+        return;
+
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus)
+        CPU_SET(cpu, &set);
+
+    int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (error != 0)
+        log_error("Failed to set the CPU affinity of the %s threads: %s", threads, strerror(error));
+#else
+    log_error("CPU affinity is only supported on Linux; the %s threads run on any CPU", threads);
+#endif
+}
+
+void ProxyBase::set_priority()
+{
+    if (options.priority == 0)
+        return;
+
+    sched_param param{};
+    param.sched_priority = options.priority;
+    int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (error != 0)
+        log_error("Failed to give the UDP thread real-time priority %d: %s", options.priority, strerror(error));
+}
+
+// Takes what the kernel attached to a datagram: the time it arrived (SO_TIMESTAMP), for the delay until
+// now, and how many datagrams the socket dropped so far because its buffer was full (SO_RXQ_OVFL)
+void ProxyBase::record_arrival(msghdr& message, unsigned worker, PacketErrorReporter::clock::time_point now)
+{
+    std::optional<int64_t> delay_us;
+    std::optional<uint32_t> drops;
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&message); cmsg; cmsg = CMSG_NXTHDR(&message, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET)
+            continue;
+
+        if (cmsg->cmsg_type == SCM_TIMESTAMP)
+        {
+            timeval arrival;
+            memcpy(&arrival, CMSG_DATA(cmsg), sizeof(arrival));
+            timeval received;
+            gettimeofday(&received, nullptr);
+            delay_us = int64_t(received.tv_sec - arrival.tv_sec) * 1000000 + (received.tv_usec - arrival.tv_usec);
+        }
+#ifdef SO_RXQ_OVFL
+        else if (cmsg->cmsg_type == SO_RXQ_OVFL)
+        {
+            uint32_t dropped;
+            memcpy(&dropped, CMSG_DATA(cmsg), sizeof(dropped));
+            drops = dropped;
+        }
+#endif
+    }
+
+    std::lock_guard guard(metrics_mutex);
+    if (delay_us)
+        ingest_stats.record_delay(*delay_us);
+    if (!drops || worker >= kernel_drops.size() || *drops == kernel_drops[worker])
+        return;
+
+    kernel_drops[worker] = *drops;
+    uint64_t total = total_kernel_drops();
+    if (now >= next_drop_report)
+    {
+        log_error("The kernel dropped %llu datagrams on port %u since the last report, %llu in total; "
+                "a larger receive_buffer may help", (unsigned long long)(total - reported_drops), port,
+                (unsigned long long)total);
+        reported_drops = total;
+        next_drop_report = now + drop_report_interval;
+    }
+}
+
+uint64_t ProxyBase::total_kernel_drops() const
+{
+    uint64_t total = 0;
+    for (uint32_t drops : kernel_drops)
+        total += drops;
+    return total;
+}
+
+void ProxyBase::udp_loop(unsigned worker)
+{
+    set_cpu_affinity(options.cpus, "UDP");
+    set_priority();
+
     int sock = socket(AF_INET, SOCK_DGRAM, 0);
     if (sock < 0)
     {
@@ -86,23 +395,136 @@ void ProxyBase::udp_loop()
     addr.sin_addr.s_addr = htonl(INADDR_ANY);
     addr.sin_port = htons(port);
 
+    // Let other listeners on this host, such as a recorder, subscribe to the same groups and port
+    int on = 1;
+    if (!multicast_groups.empty())
+        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    // Workers share the port, and the kernel spreads the senders over their sockets
+#ifdef SO_REUSEPORT
+    if (options.workers > 1)
+        setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+#else
+    if (options.workers > 1 && worker == 0)
+        log_error("SO_REUSEPORT is not supported, so only one of %u workers receives", options.workers);
+#endif
+
+    // SO_RCVBUFFORCE goes beyond net.core.rmem_max, but only with CAP_NET_ADMIN
+    if (options.receive_buffer > 0)
+    {
+        int size = options.receive_buffer;
+        bool forced = false;
+#ifdef SO_RCVBUFFORCE
+        forced = setsockopt(sock, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) == 0;
+#endif
+        if (!forced && setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) < 0)
+            log_error("Failed to set the receive buffer to %d bytes: %s", options.receive_buffer, strerror(errno));
+    }
+
+    int receive_buffer = 0;
+    socklen_t receive_buffer_len = sizeof(receive_buffer);
+    if (getsockopt(sock, SOL_SOCKET, SO_RCVBUF, &receive_buffer, &receive_buffer_len) == 0)
+    {
+        if (receive_buffer < options.receive_buffer && worker == 0)
+            log_error("Receive buffer is %d bytes instead of %d; the system limit is lower", receive_buffer,
+                    options.receive_buffer);
+        std::lock_guard guard(metrics_mutex);
+        receive_buffer_size = receive_buffer;
+    }
+
+    // Every datagram carries the number the socket dropped so far
+#ifdef SO_RXQ_OVFL
+    if (setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on)) < 0)
+        log_error("Failed to enable drop counts: %s", strerror(errno));
+#else
+    if (worker == 0)
+        log_error("SO_RXQ_OVFL is not supported; datagrams the kernel drops are not counted");
+#endif
+
+    // The kernel keeps polling the device for a while before the thread sleeps, which saves the wakeup
+    if (options.busy_poll > 0)
+    {
+#ifdef SO_BUSY_POLL
+        int busy_poll = int(options.busy_poll);
+        if (setsockopt(sock, SOL_SOCKET, SO_BUSY_POLL, &busy_poll, sizeof(busy_poll)) < 0)
+            log_error("Failed to busy poll for %u microseconds: %s", options.busy_poll, strerror(errno));
+#else
+        if (worker == 0)
+            log_error("SO_BUSY_POLL is not supported; the UDP threads do not busy poll");
+#endif
+    }
+
+    // Arrival times for the delay statistics
+    if (setsockopt(sock, SOL_SOCKET, SO_TIMESTAMP, &on, sizeof(on)) < 0)
+        log_error("Failed to enable receive timestamps: %s", strerror(errno));
+
     if (bind(sock, (sockaddr*)&addr, sizeof(addr)) < 0)
     {
         log_error("Failed to bind UDP socket: %s", strerror(errno));
         close(sock);
         return;
     }
-    log_info("UDP socket listening on port %u", port);
+    if (options.workers > 1)
+        log_info("UDP socket %u of %u listening on port %u", worker + 1, options.workers, port);
+    else
+        log_info("UDP socket listening on port %u", port);
 
-    std::vector<char> buffer(2048);
+    // The kernel hands each multicast packet to every socket on the port, SO_REUSEPORT or not, so only the
+    // first worker joins the groups; the others would only get copies. Linux also delivers the groups that
+    // any other socket joined, unless IP_MULTICAST_ALL is off.
+#ifdef IP_MULTICAST_ALL
+    int off = 0;
+    if (!multicast_groups.empty() && setsockopt(sock, IPPROTO_IP, IP_MULTICAST_ALL, &off, sizeof(off)) < 0)
+        log_error("Failed to receive only the multicast groups joined: %s", strerror(errno));
+#endif
+    for (const auto& entry : multicast_groups)
+    {
+        if (worker != 0)
+            break;
+        ip_mreq membership{};
+        membership.imr_multiaddr = entry.group;
+        membership.imr_interface = entry.interface;
+        if (setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) < 0)
+            log_error("Failed to join multicast group %s: %s", entry.name.c_str(), strerror(errno));
+        else
+            log_info("Joined multicast group %s", entry.name.c_str());
+    }
+
+    std::vector<char> buffer(options.datagram_size);
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(timeval)) + CMSG_SPACE(sizeof(uint32_t))];
+    auto spin = std::chrono::microseconds(options.spin);
+    auto last_datagram = PacketErrorReporter::clock::now();
     while (!stop_requested.load())
     {
-        ssize_t n = recv(sock, buffer.data(), buffer.size(), 0);
+        sockaddr_in source{};
+        iovec data{buffer.data(), buffer.size()};
+        msghdr message{};
+        message.msg_name = &source;
+        message.msg_namelen = sizeof(source);
+        message.msg_iov = &data;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        ssize_t n = recvmsg(sock, &message, 0);
+        auto now = PacketErrorReporter::clock::now();
+
         if (n < 0)
         {
             if (errno == EAGAIN || errno == EWOULDBLOCK)
             {
-                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                // Shortly after a datagram the next one is likely, and spinning saves waking up for it
+                if (now - last_datagram < spin)
+                    continue;
+
+                {
+                    std::lock_guard guard(reports_mutex);
+                    packet_errors.flush(now);
+                    senders.flush(now);
+                }
+
+                // Wakes up as soon as a datagram arrives; the timeout only bounds how long stop() waits
+                pollfd readable{sock, POLLIN, 0};
+                poll(&readable, 1, 100);
                 continue;
             }
 
@@ -110,23 +532,337 @@ void ProxyBase::udp_loop()
             break;
         }
 
+        last_datagram = now;
         if (n == 0)
             continue;
 
-        std::string json = udp_packet_to_json(std::span<const char>(buffer.data(), n));
+        process(source.sin_addr.s_addr, std::span<const char>(buffer.data(), n), now);
+        record_arrival(message, worker, now);
+    }
+
+    close(sock);
+    log_info("UDP socket closed");
+}
+
+void ProxyBase::ingest(uint32_t source_addr, std::span<const char> datagram)
+{
+    process(source_addr, datagram, PacketErrorReporter::clock::now());
+}
+
+void ProxyBase::process(uint32_t source_addr, std::span<const char> datagram, PacketErrorReporter::clock::time_point now)
+{
+    rejection = {PacketError::None, uint32_t(datagram.size()), 0};
+    if (!parse_packet(datagram))
+    {
+        std::lock_guard guard(reports_mutex);
+        packet_errors.report(source_addr, rejection, now);
+        return;
+    }
+
+    // Batched packets carry several samples, which are published in order
+    uint64_t key = stream_key(source_addr, packet);
+    for (size_t i = 0; i < packet.count; ++i)
+    {
+        std::string json = panel_state_to_json(packet.sample(i));
         if (json.empty())
         {
-            log_error("Failed to parse UDP packet (%zd bytes) - packet cannot be processed", n);
-            continue;
+            // All samples in a packet have the same size, so the rest would fail as well
+            std::lock_guard guard(reports_mutex);
+            packet_errors.report(source_addr, rejection, now);
+            return;
+        }
+
+        publish(key, source_addr, packet.host_id, packet.cpu, packet.seq + uint32_t(i), packet.sample_timestamp(i),
+                json, packet.sample(i), now);
+    }
+
+    {
+        std::lock_guard guard(reports_mutex);
+        packet_errors.flush(now);
+        senders.flush(now);
+        if (packet.version >= 2)
+            senders.record(source_addr, packet, now);
+    }
+
+    // Only datagrams that were accepted go upstream, unchanged
+    if (relay)
+        relay->forward(port, source_addr, datagram);
+}
+
+int ProxyBase::cpu_filter(const crow::request& req)
+{
+    const char* param = req.url_params.get("cpu");
+    if (!param || strcmp(param, "all") == 0)
+        return SampleHistory::all_cpus;
+
+    char* end;
+    unsigned long cpu = strtoul(param, &end, 10);
+    if (end == param || *end != '\0' || cpu > UINT16_MAX)
+        return invalid_cpu;
+
+    return int(cpu);
+}
+
+int ProxyBase::rate_filter(const crow::request& req)
+{
+    const char* param = req.url_params.get("rate");
+    if (!param)
+        return 0;
+
+    char* end;
+    unsigned long rate = strtoul(param, &end, 10);
+    if (end == param || *end != '\0' || rate > RateCap::max_rate)
+        return invalid_rate;
+
+    return int(rate);
+}
+
+uint64_t ProxyBase::stream_filter(const crow::request& req)
+{
+    const char* param = req.url_params.get("host");
+    if (!param || strcmp(param, "all") == 0)
+        return all_streams;
+
+    // Version 1 senders are known by their address, version 2 senders by their host id
+    in_addr addr;
+    if (inet_pton(AF_INET, param, &addr) == 1)
+        return addr.s_addr;
+
+    char* end;
+    unsigned long long host_id = strtoull(param, &end, 0);
+    if (end == param || *end != '\0' || host_id > UINT32_MAX)
+        return invalid_stream;
+
+    return (uint64_t(1) << 32) | host_id;
+}
+
+std::string ProxyBase::stream_name(uint64_t key, const Stream& stream)
+{
+    if (key >> 32)
+        return std::to_string(stream.host_id);
+
+    char address[INET_ADDRSTRLEN];
+    in_addr addr{};
+    addr.s_addr = stream.source_addr;
+    inet_ntop(AF_INET, &addr, address, sizeof(address));
+    return address;
+}
+
+ProxyBase::Stream& ProxyBase::find_stream(uint64_t key)
+{
+    auto& stream = streams[key];
+    if (!stream)
+    {
+        stream = std::make_unique<Stream>();
+        if (key >> 32)
+            stream->host_id = uint32_t(key);
+        else
+            stream->source_addr = uint32_t(key);
+        if (auto waiting = unheard_subscribers.find(key); waiting != unheard_subscribers.end())
+        {
+            stream->subscribers = std::move(waiting->second);
+            unheard_subscribers.erase(waiting);
         }
+    }
+    return *stream;
+}
 
+void ProxyBase::remove_client(crow::websocket::connection& conn)
+{
+    std::lock_guard guard(ws_clients_mutex);
+    auto it = ws_clients.find(&conn);
+    if (it == ws_clients.end())
+        return;
+
+    if (it->second.filter.stream != all_streams)
+    {
+        auto is_client = [&](const Client* subscriber) { return subscriber->conn == &conn; };
+        if (auto* stream = streams.find(it->second.filter.stream); stream && *stream)
+            std::erase_if((*stream)->subscribers, is_client);
+        else if (auto waiting = unheard_subscribers.find(it->second.filter.stream); waiting != unheard_subscribers.end())
         {
-            std::lock_guard guard(ws_clients_mutex);
-            for (auto *client : ws_clients)
-                client->send_text(json);
+            std::erase_if(waiting->second, is_client);
+            if (waiting->second.empty())
+                unheard_subscribers.erase(waiting);
         }
     }
+    ws_clients.erase(it);
+}
 
-    close(sock);
-    log_info("UDP socket closed");
+std::string ProxyBase::streams_to_json(PacketErrorReporter::clock::time_point now)
+{
+    std::string result = "{\"streams\":[";
+    bool empty = true;
+    streams.for_each([&](uint64_t key, const std::unique_ptr<Stream>& stream)
+    {
+        // Subscribers may wait for a stream that has not sent anything yet
+        if (stream->samples == 0)
+            return;
+
+        auto idle = std::chrono::duration_cast<std::chrono::milliseconds>(now - stream->last_seen).count();
+        double rate = now - stream->window_start < std::chrono::seconds(2) ? stream->rate : 0.0;
+
+        char address[INET_ADDRSTRLEN];
+        in_addr addr{};
+        addr.s_addr = stream->source_addr;
+        inet_ntop(AF_INET, &addr, address, sizeof(address));
+
+        char numbers[128];
+        snprintf(numbers, sizeof(numbers), ",\"samples\":%llu,\"rate\":%.1f,\"idle_ms\":%lld,\"subscribers\":%zu}",
+                (unsigned long long)stream->samples, rate, (long long)idle, stream->subscribers.size());
+
+        if (!empty)
+            result += ',';
+        empty = false;
+        result += "{\"id\":\"" + stream_name(key, *stream) + "\",\"host\":" + std::to_string(stream->host_id) +
+                  ",\"source\":\"" + address + '"' + numbers;
+    });
+    result += "]}";
+    return result;
+}
+
+void ProxyBase::publish(uint64_t key, uint32_t source_addr, uint32_t host_id, uint16_t cpu, uint32_t seq,
+        uint32_t timestamp, const std::string& json, std::span<const char> sample, PacketErrorReporter::clock::time_point now)
+{
+    auto registers = lamp_registers();
+    PanelLamps lamps;
+    bool has_lamps = !registers.empty() && panel_lamps(sample, lamps);
+
+    // Clients that asked for the afterglow get the state with the glow of the sample's stream and CPU,
+    // built when the first of them is sent the sample
+    const Afterglow* afterglow = nullptr;
+    std::string glowing;
+    auto text = [&](const Client& client) -> const std::string&
+    {
+        if (!client.filter.glow || !afterglow || afterglow->empty())
+            return json;
+        if (glowing.empty())
+            glowing = afterglow->attach(json);
+        return glowing;
+    };
+
+    auto deliver = [&](Client& client)
+    {
+        if (client.filter.interval == PacketErrorReporter::clock::duration::zero())
+        {
+            client.conn->send_text(text(client));
+            return;
+        }
+
+        if (client.filter.activity && has_lamps)
+            client.activity_of(key, cpu).add(lamps);
+
+        if (client.cap.open(now))
+        {
+            send_sample(client, text(client), key, cpu, now);
+            return;
+        }
+
+        if (client.cap.hold(text(client)))
+            conflated++;
+        client.held_stream = key;
+        client.held_cpu = cpu;
+        if (client.cap.due() < next_flush)
+        {
+            next_flush = client.cap.due();
+            flush_wakeup.notify_one();
+        }
+    };
+
+    {
+        std::lock_guard guard(ws_clients_mutex);
+        Stream& stream = find_stream(key);
+        stream.source_addr = source_addr;
+        if (has_lamps)
+        {
+            auto it = std::find_if(stream.afterglows.begin(), stream.afterglows.end(),
+                    [&](const auto& entry) { return entry.first == cpu; });
+            if (it == stream.afterglows.end())
+                it = stream.afterglows.emplace(stream.afterglows.end(), cpu, Afterglow());
+            it->second.add(lamps, registers, now);
+            afterglow = &it->second;
+        }
+
+        history.push(host_id, cpu, seq, timestamp, json);
+        for (auto& [conn, client] : ws_clients)
+        {
+            if (client.filter.stream == all_streams &&
+                (client.filter.cpu == SampleHistory::all_cpus || client.filter.cpu == cpu))
+                deliver(client);
+        }
+
+        stream.history.push(host_id, cpu, seq, timestamp, json);
+        for (Client* client : stream.subscribers)
+        {
+            if (client->filter.cpu == SampleHistory::all_cpus || client->filter.cpu == cpu)
+                deliver(*client);
+        }
+
+        stream.samples++;
+        stream.window_samples++;
+        stream.last_seen = now;
+        if (now - stream.window_start >= std::chrono::seconds(1))
+        {
+            stream.rate = double(stream.window_samples) / std::chrono::duration<double>(now - stream.window_start).count();
+            stream.window_samples = 0;
+            stream.window_start = now;
+        }
+
+        // Forget streams that stopped a while ago and that nobody waits for
+        if (now >= next_stream_expiry)
+        {
+            next_stream_expiry = now + std::chrono::minutes(1);
+            streams.erase_if([&](uint64_t, const std::unique_ptr<Stream>& s)
+            {
+                return s->subscribers.empty() && now - s->last_seen > stream_expiry;
+            });
+        }
+    }
+
+    if (multiplexer)
+        multiplexer->publish(multiplexer_name, host_id, cpu, seq, timestamp, json);
+}
+
+// Sends a sample to a rate-capped client, with the activity of the samples of the same stream and CPU
+// it was not sent
+void ProxyBase::send_sample(Client& client, const std::string& json, uint64_t stream, uint16_t cpu,
+        PacketErrorReporter::clock::time_point now)
+{
+    auto entry = std::find_if(client.activity.begin(), client.activity.end(),
+            [&](const StreamActivity& a) { return a.stream == stream && a.cpu == cpu; });
+    if (entry != client.activity.end())
+    {
+        client.conn->send_text(entry->activity.attach(json, lamp_registers()));
+        client.activity.erase(entry);
+    }
+    else
+        client.conn->send_text(json);
+
+    client.cap.sent(now, client.filter.interval);
+}
+
+void ProxyBase::flush_loop()
+{
+    std::unique_lock lock(ws_clients_mutex);
+    while (!stop_requested.load())
+    {
+        if (next_flush == PacketErrorReporter::clock::time_point::max())
+            flush_wakeup.wait(lock);
+        else
+            flush_wakeup.wait_until(lock, next_flush);
+
+        // Send the samples that are due, and find out when the next one is
+        auto now = PacketErrorReporter::clock::now();
+        next_flush = PacketErrorReporter::clock::time_point::max();
+        for (auto& [conn, client] : ws_clients)
+        {
+            if (!client.cap.holding())
+                continue;
+
+            if (client.cap.open(now))
+                send_sample(client, client.cap.held_sample(), client.held_stream, client.held_cpu, now);
+            else
+                next_flush = std::min(next_flush, client.cap.due());
+        }
+    }
 }
@@ -5,8 +5,23 @@
 #include <thread>
 #include <memory>
 #include <vector>
+#include <map>
+#include <condition_variable>
+#include <sys/socket.h>
+#include <netinet/in.h>
 #include "logging.hpp"
 #include "types.hpp"
+#include "packeterrors.hpp"
+#include "senderstats.hpp"
+#include "ingeststats.hpp"
+#include "samplehistory.hpp"
+#include "lampactivity.hpp"
+#include "afterglow.hpp"
+#include "ratecap.hpp"
+#include "relay.hpp"
+#include "multiplexer.hpp"
+#include "flatmap.hpp"
+#include "config.hpp"
 #define CROW_ENABLE_COMPRESSION 1
 #include "crow_all.h"
 
@@ -16,8 +31,32 @@ public:
     virtual ~ProxyBase();
     void run(); // blocks
     void stop();
-    virtual std::string udp_packet_to_json(std::span<const char> data) = 0;
+    // Converts the panel state of one sample to the JSON sent to WebSocket clients; returns an
+    // empty string if the state is not valid for this proxy
+    virtual std::string panel_state_to_json(std::span<const char> data) = 0;
+    // The panel type of the datagrams this proxy decodes, by which relay links find it
+    virtual panel_type handled_type() const = 0;
+    // The lamp registers of one sample, for the activity summaries of rate-capped clients and for the
+    // afterglow; proxies for panels without lamps have none
+    virtual std::span<const LampRegister> lamp_registers() const { return {}; }
+    virtual bool panel_lamps(std::span<const char>, PanelLamps&) { return false; }
     unsigned short get_proxy_port() const { return port; }
+    // Receives the packets sent to an IPv4 multicast group as well, on the interface with the given
+    // name or address, or on the default one; call before run(). Returns false if either is invalid.
+    bool join_multicast_group(const std::string& group, const std::string& interface = "");
+    // Sets the receive buffers, threads, CPUs and scheduling this proxy uses; call before run()
+    void set_options(const ProxyOptions& proxy_options) { options = proxy_options; }
+    // Forwards every datagram this proxy accepts to an upstream udproxy; call before run()
+    void set_relay(RelayClient* relay_client) { relay = relay_client; }
+    // Also publishes every sample to the multiplexer, under the given proxy name; call before run()
+    void set_multiplexer(StreamMultiplexer* stream_multiplexer, std::string name)
+    {
+        multiplexer = stream_multiplexer;
+        multiplexer_name = std::move(name);
+    }
+    // Handles a datagram as if it had been received over UDP from source_addr; safe to call while
+    // the proxy runs, which relay links do
+    void ingest(uint32_t source_addr, std::span<const char> datagram);
 
     // Non-copyable, non-movable
     ProxyBase(const ProxyBase&) = delete;
@@ -26,14 +65,15 @@ public:
     ProxyBase& operator=(ProxyBase&&) = delete;
 
 protected:
-    template<typename T>
-    bool get_panel_state(std::span<const char> data, T& panel_state)
+    // Decodes the version 1 or version 2 envelope of a datagram into packet
+    bool parse_packet(std::span<const char> data)
     {
-        // Check minimum size for header
+        // Failures are only recorded here; udp_loop hands them to the rate-limited error reporter
+
+        // Check minimum size for the version 1 header, which version 2 extends
         if (data.size() < sizeof(panel_packet_header))
         {
-            log_error("Packet too small for header: %zu bytes (need %zu)",
-                    data.size(), sizeof(panel_packet_header));
+            rejection = {PacketError::TooSmallForHeader, uint32_t(data.size()), uint32_t(sizeof(panel_packet_header))};
             return false;
         }
 
@@ -41,24 +81,80 @@ protected:
         panel_packet_header header;
         memcpy(&header, data.data(), sizeof(panel_packet_header));
 
+        size_t header_size = sizeof(panel_packet_header);
+        uint32_t version = (header.pp_byte_flags & PP_VERSION_MASK) >> PP_VERSION_SHIFT;
+        packet.type = uint8_t(header.pp_byte_flags & PP_TYPE_MASK);
+
+        if (version == 0)
+        {
+            packet.version = 1;
+            packet.seq = packet.timestamp = packet.host_id = 0;
+            packet.cpu = 0;
+            packet.batch = false;
+        }
+        else if (version == 2)
+        {
+            header_size = sizeof(panel_packet_header_v2);
+            if (data.size() < header_size)
+            {
+                rejection = {PacketError::TooSmallForHeader, uint32_t(data.size()), uint32_t(header_size)};
+                return false;
+            }
+
+            panel_packet_header_v2 header_v2;
+            memcpy(&header_v2, data.data(), sizeof(panel_packet_header_v2));
+            packet.version = 2;
+            packet.seq = header_v2.pp_seq;
+            packet.timestamp = header_v2.pp_timestamp;
+            packet.host_id = header_v2.pp_host_id;
+            packet.cpu = header_v2.pp_cpu;
+            packet.batch = (header.pp_byte_flags & PP_BATCH) != 0;
+        }
+        else
+        {
+            rejection = {PacketError::UnsupportedVersion, version, 2};
+            return false;
+        }
+
         // Check if we have enough data for the complete packet
-        size_t expected_total_size = sizeof(panel_packet_header) + header.pp_byte_count;
+        size_t expected_total_size = header_size + header.pp_byte_count;
         if (data.size() < expected_total_size)
         {
-            log_error("Packet too small: %zu bytes (need %zu total, header=%zu + payload=%u)",
-                    data.size(), expected_total_size, sizeof(panel_packet_header), header.pp_byte_count);
+            rejection = {PacketError::Truncated, uint32_t(data.size()), uint32_t(expected_total_size)};
             return false;
         }
 
-        // Check if the payload size matches the PDP panel state size
-        if (header.pp_byte_count != sizeof(T))
+        packet.payload = data.subspan(header_size, header.pp_byte_count);
+        packet.count = 1;
+        if (!packet.batch)
+            return true;
+
+        // A batch must hold exactly pb_count samples of pb_state_size bytes each
+        panel_batch_header batch;
+        if (packet.payload.size() >= sizeof(batch))
+            memcpy(&batch, packet.payload.data(), sizeof(batch));
+        if (packet.payload.size() < sizeof(batch) || batch.pb_count == 0 ||
+            packet.payload.size() != sizeof(batch) + size_t(batch.pb_count) * (sizeof(uint32_t) + batch.pb_state_size))
+        {
+            rejection = {PacketError::MalformedBatch, uint32_t(packet.payload.size()), 0};
+            return false;
+        }
+
+        packet.count = batch.pb_count;
+        return true;
+    }
+
+    // Copies the panel state of one sample, checking that it has the size the proxy expects
+    template<typename T>
+    bool get_panel_state(std::span<const char> data, T& panel_state)
+    {
+        if (data.size() != sizeof(T))
         {
-            log_error("Invalid payload size: %u bytes (expected %zu for panel state)",
-                    header.pp_byte_count, sizeof(T));
+            rejection = {PacketError::PayloadSizeMismatch, uint32_t(data.size()), uint32_t(sizeof(T))};
             return false;
         }
 
-        memcpy(&panel_state, data.data() + sizeof(panel_packet_header), sizeof(T));
+        memcpy(&panel_state, data.data(), sizeof(T));
         return true;
     }
 
@@ -78,13 +174,140 @@ protected:
     }
 
     unsigned short port;
+    // Per thread, so that the UDP threads and relay links parse their datagrams in parallel
+    static inline thread_local PacketRejection rejection;  // reason the last packet was rejected, if any
+    static inline thread_local panel_packet_info packet;   // envelope of the last packet that was parsed
 private:
-    void udp_loop();
+    static constexpr size_t history_capacity = 4096;   // samples kept for /history
+    static constexpr size_t stream_history_capacity = 256;     // samples kept per stream
+    static constexpr size_t initial_streams = 1024;
+    static constexpr auto stream_expiry = std::chrono::minutes(5);
+    static constexpr auto drop_report_interval = std::chrono::seconds(10);
+    static constexpr int invalid_cpu = -2;
+    static constexpr int invalid_rate = -1;
+    static constexpr uint64_t all_streams = UINT64_MAX;
+    static constexpr uint64_t invalid_stream = UINT64_MAX - 1;
+
+    // The samples a WebSocket client subscribed to, and how many per second it takes
+    struct ClientFilter
+    {
+        uint64_t stream = all_streams;
+        int cpu = SampleHistory::all_cpus;
+        PacketErrorReporter::clock::duration interval{};       // zero if uncapped
+        bool activity = false;          // summarize the lamps of the samples skipped for the cap
+        bool glow = false;              // add the afterglow of the lamps
+    };
+
+    // What the lamps of one stream and CPU did in the samples since the last of them sent to a client
+    struct StreamActivity
+    {
+        uint64_t stream;
+        uint16_t cpu;
+        LampActivity activity;
+    };
+
+    struct Client
+    {
+        crow::websocket::connection* conn;
+        ClientFilter filter;
+        RateCap cap;
+        // Kept apart by stream and CPU, so that a client of all streams gets no summaries that mix
+        // machines; only those with samples not sent yet have an entry
+        std::vector<StreamActivity> activity;
+        uint64_t held_stream = 0;       // stream and CPU of the sample the cap holds
+        uint16_t held_cpu = 0;
+
+        LampActivity& activity_of(uint64_t stream, uint16_t cpu)
+        {
+            for (auto& entry : activity)
+            {
+                if (entry.stream == stream && entry.cpu == cpu)
+                    return entry.activity;
+            }
+            return activity.emplace_back(StreamActivity{stream, cpu, {}}).activity;
+        }
+    };
+
+    // The samples of one sending host, so that hosts sending to the same port are not mixed up. Version 2
+    // packets carry a host id to tell them apart by; version 1 packets only have their source address.
+    struct Stream
+    {
+        uint32_t source_addr = 0;
+        uint32_t host_id = 0;
+        SampleHistory history{stream_history_capacity};
+        std::vector<std::pair<uint16_t, Afterglow>> afterglows;    // by CPU
+        std::vector<Client*> subscribers;
+        uint64_t samples = 0;
+        double rate = 0.0;              // samples per second over the previous rate window
+        uint64_t window_samples = 0;
+        PacketErrorReporter::clock::time_point window_start;
+        PacketErrorReporter::clock::time_point last_seen;
+    };
+
+    struct MulticastGroup
+    {
+        in_addr group;
+        in_addr interface;      // INADDR_ANY for the default interface
+        std::string name;       // as given, for logging
+    };
+
+    // CPU selected by the ?cpu= parameter of a request, SampleHistory::all_cpus if none, or invalid_cpu
+    static int cpu_filter(const crow::request& req);
+    // Stream selected by the ?host= parameter of a request, a host id or an IPv4 source address;
+    // all_streams if none, or invalid_stream
+    static uint64_t stream_filter(const crow::request& req);
+    // Samples per second asked for with the ?rate= parameter of a request, 0 for all, or invalid_rate
+    static int rate_filter(const crow::request& req);
+    static uint64_t stream_key(uint32_t source_addr, const panel_packet_info& packet)
+    {
+        return packet.version >= 2 ? (uint64_t(1) << 32) | packet.host_id : source_addr;
+    }
+    static std::string stream_name(uint64_t key, const Stream& stream);
+
+    Stream& find_stream(uint64_t key);
+    void remove_client(crow::websocket::connection& conn);
+    std::string streams_to_json(PacketErrorReporter::clock::time_point now);
+
+    void udp_loop(unsigned worker);
+    void set_cpu_affinity(const std::vector<int>& cpus, const char* threads);
+    void set_priority();
+    void record_arrival(msghdr& message, unsigned worker, PacketErrorReporter::clock::time_point now);
+    uint64_t total_kernel_drops() const;
+    void process(uint32_t source_addr, std::span<const char> datagram, PacketErrorReporter::clock::time_point now);
+    void publish(uint64_t key, uint32_t source_addr, uint32_t host_id, uint16_t cpu, uint32_t seq, uint32_t timestamp,
+            const std::string& json, std::span<const char> sample, PacketErrorReporter::clock::time_point now);
+    void send_sample(Client& client, const std::string& json, uint64_t stream, uint16_t cpu,
+            PacketErrorReporter::clock::time_point now);
+    void flush_loop();
+    void stop_flusher();
 
-    std::thread udp_thread;
+    ProxyOptions options;
+    std::vector<std::thread> udp_threads;
     std::atomic<bool> stop_requested{false};
+    PacketErrorReporter packet_errors{*this};
+    SenderTracker senders{*this};
+    std::vector<MulticastGroup> multicast_groups;
+    RelayClient* relay = nullptr;
+    StreamMultiplexer* multiplexer = nullptr;
+    std::string multiplexer_name;
+    std::mutex reports_mutex;       // guards packet_errors and senders
     crow::SimpleApp ws_server;
     std::future<void> server_future;
-    std::set<crow::websocket::connection*> ws_clients;
-    std::mutex ws_clients_mutex;
+    std::map<crow::websocket::connection*, Client> ws_clients;
+    std::map<uint64_t, std::vector<Client*>> unheard_subscribers;  // by stream, until it sends its first sample
+    SampleHistory history{history_capacity};           // samples of all streams
+    FlatHashMap<std::unique_ptr<Stream>> streams{initial_streams};
+    PacketErrorReporter::clock::time_point next_stream_expiry;
+    std::thread flusher;            // sends the samples that rate caps held back
+    std::condition_variable flush_wakeup;
+    PacketErrorReporter::clock::time_point next_flush = PacketErrorReporter::clock::time_point::max();
+    uint64_t conflated = 0;         // samples that rate caps replaced with a newer one before they were sent
+    std::mutex ws_clients_mutex;    // guards ws_clients, unheard_subscribers, history, streams, next_flush
+                                    // and conflated
+    IngestStats ingest_stats;
+    int receive_buffer_size = 0;                // SO_RCVBUF as the kernel reports it
+    std::vector<uint32_t> kernel_drops;         // by UDP socket, as counted since it was opened
+    uint64_t reported_drops = 0;
+    PacketErrorReporter::clock::time_point next_drop_report;
+    std::mutex metrics_mutex;       // guards ingest_stats, receive_buffer_size and the kernel drops
 };
@@ -0,0 +1,44 @@
+#pragma once
+#include <chrono>
+#include <string>
+
+// Caps the samples per second sent to one WebSocket client or multiplexer subscription. A sample that
+// comes in before the cap allows another is held, in place of any that was held already, so that the
+// most recent one is sent once the interval has passed; replacing a held sample is called conflation.
+// The owner sends the samples that are held when they become due.
+class RateCap
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    static constexpr int max_rate = 1000;      // samples per second that can be asked for
+
+    // Whether a sample can be sent now rather than held
+    bool open(clock::time_point now) const { return now >= next_send; }
+
+    // Starts the next interval after a sample was sent, which drops whatever was held
+    void sent(clock::time_point now, clock::duration interval)
+    {
+        next_send = now + interval;
+        held = false;
+    }
+
+    // Holds a sample that came too soon; true if it replaced one that was held already
+    bool hold(const std::string& sample)
+    {
+        bool replaced = held;
+        pending = sample;
+        held = true;
+        return replaced;
+    }
+
+    bool holding() const { return held; }
+    const std::string& held_sample() const { return pending; }
+    // When the held sample is due
+    clock::time_point due() const { return next_send; }
+
+private:
+    clock::time_point next_send;    // earliest time the cap allows another sample
+    std::string pending;            // reused, so that holding rarely allocates
+    bool held = false;
+};
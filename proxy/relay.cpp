@@ -0,0 +1,478 @@
+#include "relay.hpp"
+#include "proxybase.hpp"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <utility>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0      // macOS, where SO_NOSIGPIPE is set on the socket instead
+#endif
+
+namespace
+{
+    bool recv_all(int sock, char* data, size_t size)
+    {
+        while (size > 0)
+        {
+            ssize_t n = recv(sock, data, size, 0);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            data += n;
+            size -= size_t(n);
+        }
+        return true;
+    }
+}
+
+RelayClient::RelayClient(std::string host, unsigned short port, bool compress)
+    : host(std::move(host))
+    , port(port)
+    , compress(compress)
+{
+}
+
+RelayClient::~RelayClient()
+{
+    stop();
+}
+
+void RelayClient::start()
+{
+    thread = std::thread([&]() { run(); });
+}
+
+void RelayClient::stop()
+{
+    {
+        std::lock_guard guard(mutex);
+        stop_requested = true;
+    }
+    wakeup.notify_all();
+    if (thread.joinable())
+        thread.join();
+}
+
+void RelayClient::forward(unsigned short proxy_port, uint32_t source_addr, std::span<const char> datagram)
+{
+    relay_record_header record{source_addr, htons(proxy_port), htons(uint16_t(datagram.size()))};
+
+    std::lock_guard guard(mutex);
+    if (!connected || pending.size() + sizeof(record) + datagram.size() > max_pending)
+    {
+        dropped++;
+        return;
+    }
+
+    const char* header = reinterpret_cast<const char*>(&record);
+    pending.insert(pending.end(), header, header + sizeof(record));
+    pending.insert(pending.end(), datagram.begin(), datagram.end());
+
+    if (pending.size() >= flush_bytes)
+        wakeup.notify_one();
+}
+
+void RelayClient::run()
+{
+    auto backoff = std::chrono::milliseconds(100);
+    bool failing = false;
+    std::vector<char> records;
+    std::unique_lock lock(mutex);
+
+    while (!stop_requested)
+    {
+        if (!connected)
+        {
+            lock.unlock();
+            // Only the first of a series of failed attempts is logged
+            bool success = connect_upstream(!failing);
+            lock.lock();
+
+            failing = !success;
+            if (!success)
+            {
+                wakeup.wait_for(lock, backoff, [&] { return stop_requested; });
+                backoff = std::min<std::chrono::milliseconds>(backoff * 2, max_backoff);
+                continue;
+            }
+
+            log_info("Relaying to %s:%u%s", host.c_str(), port, compress ? " with compression" : "");
+            backoff = std::chrono::milliseconds(100);
+            connected = true;
+        }
+
+        // Collect datagrams for one flush interval, or until enough are queued
+        wakeup.wait_for(lock, flush_interval, [&] { return stop_requested || pending.size() >= flush_bytes; });
+        if (pending.empty())
+            continue;
+
+        records.swap(pending);
+        pending.clear();
+        uint64_t dropped_now = std::exchange(dropped, 0);
+        lock.unlock();
+
+        if (dropped_now > 0)
+            log_error("Dropped %s datagrams that could not be relayed", format_count(dropped_now).c_str());
+
+        errno = 0;
+        bool sent = send_frame(records);
+        int error = errno;
+        lock.lock();
+
+        if (!sent)
+        {
+            if (!stop_requested)
+                log_error("Relay link to %s:%u failed: %s", host.c_str(), port, error ? strerror(error) : "connection closed");
+            close(sock);
+            sock = -1;
+            connected = false;
+        }
+    }
+
+    if (sock >= 0)
+    {
+        close(sock);
+        sock = -1;
+    }
+}
+
+bool RelayClient::connect_upstream(bool report)
+{
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo* addresses = nullptr;
+    std::string service = std::to_string(port);
+    if (int error = getaddrinfo(host.c_str(), service.c_str(), &hints, &addresses); error != 0)
+    {
+        if (report)
+            log_error("Cannot resolve relay upstream %s: %s", host.c_str(), gai_strerror(error));
+        return false;
+    }
+
+    for (addrinfo* it = addresses; it && sock < 0; it = it->ai_next)
+    {
+        sock = socket(it->ai_family, it->ai_socktype, it->ai_protocol);
+        if (sock < 0)
+            continue;
+
+        // Non-blocking, so that neither connecting nor sending can hold up stop()
+        fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+        if (connect(sock, it->ai_addr, it->ai_addrlen) < 0 && (errno != EINPROGRESS || !finish_connect()))
+        {
+            int error = errno;
+            close(sock);
+            sock = -1;
+            errno = error;
+        }
+    }
+    freeaddrinfo(addresses);
+
+    if (sock < 0)
+    {
+        if (report && errno != ECANCELED)
+            log_error("Cannot connect to relay upstream %s:%u: %s", host.c_str(), port, strerror(errno));
+        return false;
+    }
+
+    // Frames are already batched, so send them right away
+    int on = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+#ifdef SO_NOSIGPIPE
+    setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+    return true;
+}
+
+bool RelayClient::finish_connect()
+{
+    if (!wait_until_ready(POLLOUT, connect_timeout))
+        return false;
+
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &length) < 0)
+        return false;
+    errno = error;
+    return error == 0;
+}
+
+bool RelayClient::wait_until_ready(short events, std::chrono::milliseconds timeout)
+{
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (true)
+    {
+        {
+            std::lock_guard guard(mutex);
+            if (stop_requested)
+            {
+                errno = ECANCELED;
+                return false;
+            }
+        }
+
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        if (left.count() <= 0)
+        {
+            errno = ETIMEDOUT;
+            return false;
+        }
+
+        pollfd pfd{sock, events, 0};
+        int ready = poll(&pfd, 1, int(std::min(left, stop_poll_interval).count()));
+        if (ready > 0)
+            return true;
+        if (ready < 0 && errno != EINTR)
+            return false;
+    }
+}
+
+bool RelayClient::send_all(const char* data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t n = send(sock, data, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            // The upstream is not keeping up; give up on the link if that lasts
+            if (!wait_until_ready(POLLOUT, send_timeout))
+                return false;
+            continue;
+        }
+        if (n <= 0)
+            return false;
+        data += n;
+        size -= size_t(n);
+    }
+    return true;
+}
+
+bool RelayClient::send_frame(const std::vector<char>& records)
+{
+    uint32_t length = uint32_t(records.size());
+    uint32_t flags = 0;
+    const char* payload = records.data();
+
+    // Panel states change little from one sample to the next, so they compress well; still, only
+    // use the compressed form if it is smaller
+    if (compress)
+    {
+        uLongf compressed_length = compressBound(uLong(records.size()));
+        compressed.resize(compressed_length);
+        if (compress2(reinterpret_cast<Bytef*>(compressed.data()), &compressed_length,
+                reinterpret_cast<const Bytef*>(records.data()), uLong(records.size()), Z_BEST_SPEED) == Z_OK &&
+            compressed_length < records.size())
+        {
+            flags = RF_ZLIB;
+            length = uint32_t(compressed_length);
+            payload = compressed.data();
+        }
+    }
+
+    relay_frame_header header{htonl(RELAY_MAGIC), htonl(flags), htonl(length), htonl(uint32_t(records.size()))};
+    return send_all(reinterpret_cast<const char*>(&header), sizeof(header)) &&
+           send_all(payload, length);
+}
+
+RelayServer::RelayServer(in_addr address, unsigned short port, ProxyLookup find_proxy)
+    : address(address)
+    , port(port)
+    , find_proxy(std::move(find_proxy))
+{
+}
+
+RelayServer::~RelayServer()
+{
+    stop();
+}
+
+void RelayServer::start()
+{
+    listen_sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_sock < 0)
+    {
+        log_error("Failed to create relay socket: %s", strerror(errno));
+        return;
+    }
+
+    int on = 1;
+    setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr = address;
+    addr.sin_port = htons(port);
+
+    char name[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &address, name, sizeof(name));
+    if (bind(listen_sock, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listen_sock, 16) < 0)
+    {
+        log_error("Failed to listen for relay links on %s:%u: %s", name, port, strerror(errno));
+        close(listen_sock);
+        listen_sock = -1;
+        return;
+    }
+
+    log_info("Accepting relay links on %s:%u", name, port);
+    accept_thread = std::thread([&]() { accept_loop(); });
+}
+
+void RelayServer::stop()
+{
+    stop_requested.store(true);
+    if (accept_thread.joinable())
+        accept_thread.join();
+
+    // Wake up the links blocked in recv()
+    std::lock_guard guard(links_mutex);
+    for (auto& link : links)
+        shutdown(link.sock, SHUT_RDWR);
+    for (auto& link : links)
+    {
+        if (link.thread.joinable())
+            link.thread.join();
+        close(link.sock);
+    }
+    links.clear();
+
+    if (listen_sock >= 0)
+    {
+        close(listen_sock);
+        listen_sock = -1;
+    }
+}
+
+void RelayServer::accept_loop()
+{
+    while (!stop_requested.load())
+    {
+        pollfd pfd{listen_sock, POLLIN, 0};
+        int ready = poll(&pfd, 1, 100);
+
+        // Clean up after links that ended
+        {
+            std::lock_guard guard(links_mutex);
+            for (auto it = links.begin(); it != links.end();)
+            {
+                if (!it->done.load())
+                {
+                    ++it;
+                    continue;
+                }
+
+                it->thread.join();
+                close(it->sock);
+                it = links.erase(it);
+            }
+        }
+
+        if (ready <= 0)
+            continue;
+
+        sockaddr_in peer{};
+        socklen_t peer_len = sizeof(peer);
+        int sock = accept(listen_sock, (sockaddr*)&peer, &peer_len);
+        if (sock < 0)
+            continue;
+
+        char address[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &peer.sin_addr, address, sizeof(address));
+
+        std::lock_guard guard(links_mutex);
+        Link& link = links.emplace_back();
+        link.sock = sock;
+        link.peer = std::string(address) + ":" + std::to_string(ntohs(peer.sin_port));
+        link.thread = std::thread([this, &link]() { serve(link); });
+    }
+}
+
+void RelayServer::serve(Link& link)
+{
+    log_info("Relay link from %s connected", link.peer.c_str());
+
+    std::vector<char> payload;
+    std::vector<char> records;
+    while (!stop_requested.load())
+    {
+        relay_frame_header header;
+        if (!recv_all(link.sock, reinterpret_cast<char*>(&header), sizeof(header)))
+            break;
+        header.rf_magic = ntohl(header.rf_magic);
+        header.rf_flags = ntohl(header.rf_flags);
+        header.rf_length = ntohl(header.rf_length);
+        header.rf_raw_length = ntohl(header.rf_raw_length);
+
+        if (header.rf_magic != RELAY_MAGIC || header.rf_length > max_frame_bytes || header.rf_raw_length > max_frame_bytes)
+        {
+            log_error("Relay link from %s sent an invalid frame, closing it", link.peer.c_str());
+            break;
+        }
+
+        payload.resize(header.rf_length);
+        if (!recv_all(link.sock, payload.data(), payload.size()))
+            break;
+
+        std::span<const char> frame(payload);
+        if (header.rf_flags & RF_ZLIB)
+        {
+            uLongf length = header.rf_raw_length;
+            records.resize(length);
+            if (uncompress(reinterpret_cast<Bytef*>(records.data()), &length,
+                    reinterpret_cast<const Bytef*>(payload.data()), uLong(payload.size())) != Z_OK ||
+                length != header.rf_raw_length)
+            {
+                log_error("Relay link from %s sent a frame that does not decompress, closing it", link.peer.c_str());
+                break;
+            }
+            frame = std::span<const char>(records);
+        }
+
+        if (!dispatch(link, frame))
+            break;
+    }
+
+    log_info("Relay link from %s closed", link.peer.c_str());
+    link.done.store(true);
+}
+
+bool RelayServer::dispatch(Link& link, std::span<const char> records)
+{
+    while (!records.empty())
+    {
+        relay_record_header record;
+        if (records.size() < sizeof(record) ||
+            (memcpy(&record, records.data(), sizeof(record)), records.size() - sizeof(record) < ntohs(record.rr_length)))
+        {
+            log_error("Relay link from %s sent a truncated record, closing it", link.peer.c_str());
+            return false;
+        }
+
+        size_t length = ntohs(record.rr_length);
+        std::span<const char> datagram = records.subspan(sizeof(record), length);
+        records = records.subspan(sizeof(record) + length);
+
+        // Datagrams too short for a header, or for panel types this udproxy has no proxy for, are skipped
+        panel_packet_header header;
+        if (datagram.size() < sizeof(header))
+            continue;
+        memcpy(&header, datagram.data(), sizeof(header));
+        if (auto proxy = find_proxy(panel_type(header.pp_byte_flags & PP_TYPE_MASK)))
+            proxy->ingest(record.rr_source_addr, datagram);
+    }
+
+    return true;
+}
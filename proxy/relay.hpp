@@ -0,0 +1,135 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+#include <netinet/in.h>
+#include "logging.hpp"
+#include "types.hpp"
+
+class ProxyBase;
+
+// A relay link is a TCP connection over which a downstream udproxy forwards the datagrams its proxies
+// accepted to an upstream udproxy. The link carries frames, each a relay_frame_header followed by
+// rf_length bytes of records, zlib-compressed if RF_ZLIB is set. Each record is a relay_record_header
+// followed by the datagram exactly as the panel client sent it. All header fields are in network byte
+// order, so that hosts of either endianness can be linked.
+constexpr uint32_t RELAY_MAGIC = 0x55505232;    // "UPR2"
+constexpr uint32_t RF_ZLIB = 0x00000001;
+
+#pragma pack(push, 1)
+
+struct relay_frame_header
+{
+    uint32_t rf_magic;          /* RELAY_MAGIC */
+    uint32_t rf_flags;          /* RF_ZLIB if the records are compressed */
+    uint32_t rf_length;         /* Bytes that follow this header */
+    uint32_t rf_raw_length;     /* Bytes of records after decompression */
+};
+
+struct relay_record_header
+{
+    uint32_t rr_source_addr;    /* IPv4 address the datagram came from, network byte order */
+    uint16_t rr_port;           /* Port of the proxy that accepted it, only for information */
+    uint16_t rr_length;         /* Size of the datagram */
+};
+
+#pragma pack(pop)
+
+// Forwards accepted datagrams to an upstream udproxy over one persistent TCP connection, reconnecting
+// when it drops or sending stalls for send_timeout. Datagrams are collected for up to flush_interval and
+// sent as one frame. While there is no connection they are dropped, as they would be stale by the time
+// it is back.
+class RelayClient : public Loggable
+{
+public:
+    RelayClient(std::string host, unsigned short port, bool compress);
+    ~RelayClient();
+    const char* module_name() const override { return "RelayClient"; }
+    void start();
+    void stop();
+
+    // Queues a datagram that the proxy on proxy_port accepted from source_addr; called by the proxies
+    void forward(unsigned short proxy_port, uint32_t source_addr, std::span<const char> datagram);
+
+private:
+    static constexpr auto flush_interval = std::chrono::milliseconds(10);
+    static constexpr size_t flush_bytes = 64 * 1024;        // send a frame early once this much is queued
+    static constexpr size_t max_pending = 1024 * 1024;      // drop datagrams beyond this while sending stalls
+    static constexpr auto max_backoff = std::chrono::seconds(5);
+    static constexpr auto connect_timeout = std::chrono::milliseconds(5000);
+    static constexpr auto send_timeout = std::chrono::milliseconds(10000);     // the link is dropped when sending stalls this long
+    static constexpr auto stop_poll_interval = std::chrono::milliseconds(100); // how soon a blocked connect or send sees stop()
+
+    void run();
+    bool connect_upstream(bool report);
+    bool finish_connect();
+    // Waits for the socket to become ready for events; false with errno ETIMEDOUT, or ECANCELED once
+    // stop() was called
+    bool wait_until_ready(short events, std::chrono::milliseconds timeout);
+    bool send_all(const char* data, size_t size);
+    bool send_frame(const std::vector<char>& records);
+
+    std::string host;
+    unsigned short port;
+    bool compress;
+    int sock = -1;
+    std::thread thread;
+    std::vector<char> compressed;       // only used by the relay thread
+
+    std::mutex mutex;                   // guards everything below
+    std::condition_variable wakeup;
+    bool stop_requested = false;
+    bool connected = false;
+    std::vector<char> pending;          // records of the next frame
+    uint64_t dropped = 0;               // datagrams dropped since the last report
+};
+
+// Accepts relay links from downstream udproxy instances and hands every datagram they carry to the local
+// proxy for its panel type, which publishes it as if it had been received over UDP. Ports are configured
+// per udproxy, so the port a datagram arrived on downstream says nothing here. Each link is served by
+// its own thread. Links are not authenticated, so the server should only listen where the downstream
+// instances, and nobody else, can reach it.
+class RelayServer : public Loggable
+{
+public:
+    using ProxyLookup = std::function<std::shared_ptr<ProxyBase>(panel_type type)>;
+
+    RelayServer(in_addr address, unsigned short port, ProxyLookup find_proxy);
+    ~RelayServer();
+    const char* module_name() const override { return "RelayServer"; }
+    void start();
+    void stop();
+
+private:
+    static constexpr uint32_t max_frame_bytes = 4 * 1024 * 1024;
+
+    struct Link
+    {
+        int sock;
+        std::string peer;
+        std::thread thread;
+        std::atomic<bool> done{false};
+    };
+
+    void accept_loop();
+    void serve(Link& link);
+    bool dispatch(Link& link, std::span<const char> records);
+
+    in_addr address;                    // to listen on, INADDR_ANY for all interfaces
+    unsigned short port;
+    ProxyLookup find_proxy;
+    int listen_sock = -1;
+    std::thread accept_thread;
+    std::atomic<bool> stop_requested{false};
+    std::mutex links_mutex;             // guards links
+    std::list<Link> links;
+};
@@ -0,0 +1,95 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Fixed-size ring of the most recent samples a proxy published. Entries are overwritten in place,
+// so once the ring has filled up, storing a sample reuses the string capacity of the one it evicts.
+class SampleHistory
+{
+public:
+    static constexpr int all_cpus = -1;     // CPU filter that matches every sample
+
+    struct Sample
+    {
+        uint32_t host_id = 0;
+        uint16_t cpu = 0;
+        uint32_t seq = 0;
+        uint32_t timestamp = 0;     // sender time in microseconds (wraps), 0 for version 1 packets
+        std::string json;
+    };
+
+    explicit SampleHistory(size_t capacity)
+        : samples(capacity)
+    {
+    }
+
+    void push(uint32_t host_id, uint16_t cpu, uint32_t seq, uint32_t timestamp, const std::string& json)
+    {
+        Sample& sample = samples[next];
+        sample.host_id = host_id;
+        sample.cpu = cpu;
+        sample.seq = seq;
+        sample.timestamp = timestamp;
+        sample.json = json;
+
+        next = (next + 1) % samples.size();
+        if (count < samples.size())
+            count++;
+    }
+
+    size_t size() const { return count; }
+
+    // Most recent sample of the given CPU, or of any CPU; nullptr if there is none
+    const Sample* latest(int cpu = all_cpus) const
+    {
+        for (size_t i = 1; i <= count; ++i)
+        {
+            const Sample& sample = at(count - i);
+            if (cpu == all_cpus || sample.cpu == cpu)
+                return &sample;
+        }
+        return nullptr;
+    }
+
+    // Serializes the last limit samples of the given CPU, or of any CPU, oldest first, as
+    // {"samples":[{...,"state":{...}},...]}
+    std::string to_json(size_t limit, int cpu = all_cpus) const
+    {
+        // Find the oldest of the samples to include
+        size_t first = count;
+        for (size_t n = 0; first > 0 && n < limit; --first)
+        {
+            if (cpu == all_cpus || at(first - 1).cpu == cpu)
+                n++;
+        }
+
+        std::string result = "{\"samples\":[";
+        bool empty = true;
+        for (size_t i = first; i < count; ++i)
+        {
+            const Sample& sample = at(i);
+            if (cpu != all_cpus && sample.cpu != cpu)
+                continue;
+            if (!empty)
+                result += ',';
+            empty = false;
+            result += "{\"host\":" + std::to_string(sample.host_id) +
+                      ",\"cpu\":" + std::to_string(sample.cpu) +
+                      ",\"seq\":" + std::to_string(sample.seq) +
+                      ",\"timestamp\":" + std::to_string(sample.timestamp) +
+                      ",\"state\":" + sample.json + '}';
+        }
+        result += "]}";
+        return result;
+    }
+
+private:
+    // The i-th oldest sample still held
+    const Sample& at(size_t i) const { return samples[(next + samples.size() - count + i) % samples.size()]; }
+
+    std::vector<Sample> samples;
+    size_t next = 0;
+    size_t count = 0;
+};
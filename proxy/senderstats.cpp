@@ -0,0 +1,211 @@
+#include "senderstats.hpp"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace
+{
+    double percentage(uint64_t part, uint64_t whole)
+    {
+        return whole ? 100.0 * double(part) / double(whole) : 0.0;
+    }
+
+    std::string format_address(uint32_t source_addr)
+    {
+        char address[INET_ADDRSTRLEN];
+        in_addr addr{};
+        addr.s_addr = source_addr;
+        inet_ntop(AF_INET, &addr, address, sizeof(address));
+        return address;
+    }
+}
+
+SenderTracker::SenderTracker(const Loggable& owner)
+    : owner(owner)
+    , next_report(clock::now() + report_interval)
+{
+}
+
+void SenderTracker::restart(Sender& sender, uint32_t seq) const
+{
+    // Pretend the previous sequence number was the highest, so seq is accounted as in order
+    sender.highest_seq = uint64_t(seq) - 1;
+    sender.window = 0;
+    sender.timed = false;
+}
+
+void SenderTracker::record(uint32_t source_addr, const panel_packet_info& packet, clock::time_point now)
+{
+    // Transit time of the last sample, which is the one closest to the time the packet was sent
+    uint32_t arrival = uint32_t(std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch()).count());
+    int32_t transit = int32_t(arrival - packet.sample_timestamp(packet.count - 1));
+
+    auto [it, inserted] = senders.try_emplace(Key{source_addr, packet.host_id, packet.cpu});
+    Sender& sender = it->second;
+    sender.last_seen = now;
+
+    if (inserted)
+        restart(sender, packet.seq);
+
+    bool in_order = false;
+    for (uint32_t i = 0; i < packet.count; ++i)
+        in_order = account(sender, packet.seq + i);
+
+    if (in_order)
+        update_timing(sender, transit);
+}
+
+bool SenderTracker::account(Sender& sender, uint32_t seq) const
+{
+    // Distance from the highest sequence number so far, taking 32-bit wraparound into account
+    int64_t delta = int32_t(seq - uint32_t(sender.highest_seq));
+
+    // A large jump either way means the sender restarted its sequence numbers
+    if (delta >= max_gap || delta <= -restart_threshold)
+    {
+        restart(sender, seq);
+        delta = 1;
+    }
+
+    if (delta > 0)
+    {
+        sender.window = delta < 64 ? (sender.window << delta) | 1 : 1;
+        sender.highest_seq += delta;
+        sender.total.expected += delta;
+        sender.total.received++;
+        return true;
+    }
+
+    if (-delta < 64)
+    {
+        uint64_t bit = uint64_t(1) << -delta;
+        if (sender.window & bit)
+            sender.total.duplicates++;
+        else
+        {
+            sender.window |= bit;
+            sender.total.received++;
+            sender.total.reordered++;
+        }
+    }
+    else
+    {
+        // Too late to tell apart from a duplicate; count it as a late arrival
+        sender.total.received++;
+        sender.total.reordered++;
+    }
+
+    return false;
+}
+
+void SenderTracker::update_timing(Sender& sender, int32_t transit) const
+{
+    if (!sender.timed)
+    {
+        sender.timed = true;
+        sender.last_transit = transit;
+        sender.transit = sender.min_transit = sender.max_transit = 0;
+        return;
+    }
+
+    // RFC 3550 interarrival jitter, only over packets that arrive in order
+    int32_t difference = transit - sender.last_transit;
+    sender.last_transit = transit;
+    sender.jitter += (std::abs(double(difference)) - sender.jitter) / 16.0;
+
+    sender.transit += difference;
+    sender.min_transit = std::min(sender.min_transit, sender.transit);
+    sender.max_transit = std::max(sender.max_transit, sender.transit);
+}
+
+void SenderTracker::report(clock::time_point now)
+{
+    next_report = now + report_interval;
+
+    struct Line
+    {
+        Key key;
+        Counters interval;
+        double jitter;
+        int64_t spread;
+    };
+
+    Counters all;
+    double worst_jitter = 0.0;
+    size_t active = 0;
+    std::vector<Line> lines;
+    std::vector<std::pair<Key, clock::duration>> stopped;
+
+    for (auto it = senders.begin(); it != senders.end();)
+    {
+        Sender& sender = it->second;
+
+        Counters interval;
+        interval.received = sender.total.received - sender.reported.received;
+        interval.expected = sender.total.expected - sender.reported.expected;
+        interval.duplicates = sender.total.duplicates - sender.reported.duplicates;
+        interval.reordered = sender.total.reordered - sender.reported.reordered;
+        sender.reported = sender.total;
+
+        if (interval.received > 0)
+        {
+            active++;
+            all.received += interval.received;
+            all.expected += interval.expected;
+            all.duplicates += interval.duplicates;
+            all.reordered += interval.reordered;
+            worst_jitter = std::max(worst_jitter, sender.jitter);
+
+            if (interval.lost() || interval.duplicates || interval.reordered)
+                lines.push_back({it->first, interval, sender.jitter, sender.max_transit - sender.min_transit});
+            sender.stopped = false;
+        }
+        else if (!sender.stopped)
+        {
+            sender.stopped = true;
+            stopped.emplace_back(it->first, now - sender.last_seen);
+        }
+
+        sender.min_transit = sender.max_transit = sender.transit;
+
+        // Forget senders that stopped sending a while ago
+        if (now - sender.last_seen > idle_expiry)
+            it = senders.erase(it);
+        else
+            ++it;
+    }
+
+    for (const auto& [key, silence] : stopped)
+    {
+        owner.log_info("%s host %08x cpu %u stopped sending %lld s ago", format_address(key.source_addr).c_str(),
+                key.host_id, key.cpu, (long long)std::chrono::duration_cast<std::chrono::seconds>(silence).count());
+    }
+
+    if (active == 0)
+        return;
+
+    owner.log_info("%zu %s: %s samples, %s lost (%.2f%%), %s duplicate, %s reordered, worst jitter %.2f ms",
+            active, active == 1 ? "sender" : "senders", format_count(all.received).c_str(),
+            format_count(all.lost()).c_str(), percentage(all.lost(), all.expected),
+            format_count(all.duplicates).c_str(), format_count(all.reordered).c_str(), worst_jitter / 1000.0);
+
+    // Detail the senders that lost the most packets
+    std::sort(lines.begin(), lines.end(), [](const Line& a, const Line& b) { return a.interval.lost() > b.interval.lost(); });
+
+    for (size_t i = 0; i < lines.size() && i < max_detail_lines; ++i)
+    {
+        const Line& line = lines[i];
+        owner.log_info("  %s host %08x cpu %u: %s samples, %s lost (%.2f%%), %s duplicate, %s reordered, "
+                "jitter %.2f ms, delay spread %.2f ms",
+                format_address(line.key.source_addr).c_str(), line.key.host_id, line.key.cpu, format_count(line.interval.received).c_str(),
+                format_count(line.interval.lost()).c_str(), percentage(line.interval.lost(), line.interval.expected),
+                format_count(line.interval.duplicates).c_str(), format_count(line.interval.reordered).c_str(),
+                line.jitter / 1000.0, double(line.spread) / 1000.0);
+    }
+
+    if (lines.size() > max_detail_lines)
+        owner.log_info("  and %zu more senders with losses", lines.size() - max_detail_lines);
+}
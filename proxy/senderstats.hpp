@@ -0,0 +1,90 @@
+#pragma once
+#include <cstdint>
+#include <chrono>
+#include <unordered_map>
+#include "logging.hpp"
+#include "types.hpp"
+
+// Per-sender delivery statistics for version 2 packets. Senders are identified by (source address,
+// host id, CPU); for each of them the tracker counts lost, duplicate and reordered packets from the
+// sequence numbers, and estimates jitter (RFC 3550) and queueing delay from the sender timestamps.
+// Sender and proxy clocks are not synchronized, so instead of an absolute one-way latency the
+// tracker reports the delay spread: how far transit times varied within the interval.
+// Clients resend an unchanged state as a heartbeat, so a sender that sent nothing during a whole
+// interval has stopped rather than gone idle; the report names such senders once.
+class SenderTracker
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    explicit SenderTracker(const Loggable& owner);
+
+    // Record a packet that was accepted from source_addr; a batch counts as all of its samples
+    void record(uint32_t source_addr, const panel_packet_info& packet, clock::time_point now);
+
+    // Log a report for the last interval if the report interval has passed
+    void flush(clock::time_point now)
+    {
+        if (now >= next_report)
+            report(now);
+    }
+
+private:
+    static constexpr auto report_interval = std::chrono::seconds(60);
+    static constexpr auto idle_expiry = std::chrono::minutes(5);
+    static constexpr int64_t restart_threshold = 1024;     // sequence jump back that means a restart
+    static constexpr int64_t max_gap = 1 << 20;             // sequence jump ahead that means a restart
+    static constexpr size_t max_detail_lines = 10;          // senders with losses logged per report
+
+    struct Key
+    {
+        uint32_t source_addr;
+        uint32_t host_id;
+        uint16_t cpu;
+
+        bool operator==(const Key&) const = default;
+    };
+
+    struct KeyHash
+    {
+        size_t operator()(const Key& key) const
+        {
+            return std::hash<uint64_t>{}((uint64_t(key.source_addr) << 32) | key.host_id) ^ (size_t(key.cpu) << 1);
+        }
+    };
+
+    struct Counters
+    {
+        uint64_t received = 0;
+        uint64_t expected = 0;
+        uint64_t duplicates = 0;
+        uint64_t reordered = 0;
+
+        uint64_t lost() const { return expected > received ? expected - received : 0; }
+    };
+
+    struct Sender
+    {
+        uint64_t highest_seq = 0;       // highest sequence number seen, extended past 32-bit wraps
+        uint64_t window = 0;            // bit n set: highest_seq - n was received
+        Counters total;
+        Counters reported;              // total as of the previous report
+        bool timed = false;             // last_transit is valid
+        int32_t last_transit = 0;       // arrival time minus sender timestamp, microseconds (wraps)
+        int64_t transit = 0;            // transit relative to the first packet, unwrapped
+        int64_t min_transit = 0;        // lowest and highest relative transit in this interval
+        int64_t max_transit = 0;
+        double jitter = 0.0;            // microseconds
+        bool stopped = false;           // reported as no longer sending
+        clock::time_point last_seen;
+    };
+
+    void restart(Sender& sender, uint32_t seq) const;
+    bool account(Sender& sender, uint32_t seq) const;
+    void update_timing(Sender& sender, int32_t transit) const;
+    void report(clock::time_point now);
+
+    const Loggable& owner;
+    std::unordered_map<Key, Sender, KeyHash> senders;
+    clock::time_point next_report;
+};
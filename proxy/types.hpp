@@ -1,7 +1,31 @@
 #pragma once
 
 #include <cstdint>
+#include <cstring>
+#include <span>
 
+// Panel type values carried in pp_byte_flags, matching panel_type_t in socket/common.c
+enum panel_type : uint32_t
+{
+    PANEL_PDP1170 = 1,      /* PDP-11/70 2.11BSD panel */
+    PANEL_VAX = 2,          /* VAX NetBSD panel */
+    PANEL_NETBSDX64 = 3,    /* NetBSD x64 panel */
+    PANEL_MACOS = 4,        /* macOS panel */
+    PANEL_LINUXX64 = 5      /* Linux x64 panel */
+};
+
+// The protocol version is carried in the top byte of pp_byte_flags; version 1 senders leave it 0
+constexpr uint32_t PP_TYPE_MASK = 0x000000ff;
+constexpr uint32_t PP_VERSION_SHIFT = 24;
+constexpr uint32_t PP_VERSION_MASK = 0xff000000;
+constexpr uint32_t PP_VERSION_2 = 2u << PP_VERSION_SHIFT;
+
+// Version 2 flag: the payload is a panel_batch_header followed by pb_count samples, each a uint32_t
+// offset in microseconds from pp_timestamp followed by a panel state. Sample i has sequence number
+// pp_seq + i.
+constexpr uint32_t PP_BATCH = 0x00000100;
+
+// Packet structure definitions - use tight packing to match network protocol
 #pragma pack(push, 1)
 
 struct panel_packet_header
@@ -10,4 +34,195 @@ struct panel_packet_header
     uint32_t pp_byte_flags;    /* Panel type flags (PANEL_PDP1170, PANEL_VAX, etc.) */
 };
 
-#pragma pack(pop)
\ No newline at end of file
+/* Version 2 header: the version 1 header followed by information about the sender */
+struct panel_packet_header_v2
+{
+    uint16_t pp_byte_count;    /* Size of the panel_state payload */
+    uint32_t pp_byte_flags;    /* Panel type | PP_VERSION_2 */
+    uint32_t pp_seq;           /* Per-sender sequence number, incremented for every sample */
+    uint32_t pp_timestamp;     /* Sender monotonic clock when sampled, microseconds (wraps) */
+    uint32_t pp_host_id;       /* Identifies the sending host */
+    uint16_t pp_cpu;           /* CPU the state was sampled on, 0 on single-processor senders */
+};
+
+/* Payload prefix of a PP_BATCH packet */
+struct panel_batch_header
+{
+    uint16_t pb_count;         /* Number of samples that follow */
+    uint16_t pb_state_size;    /* Size of the panel state in each sample */
+};
+
+/* PDP-11 panel state, as sent by socket/arch/211BSD */
+struct pdp_panel_state
+{
+    uint32_t ps_address;    /* panel switches - 32-bit address */
+    uint16_t ps_data;       /* panel lamps - 16-bit data */
+    uint16_t ps_psw;        /* processor status word */
+    uint16_t ps_mser;       /* machine status register */
+    uint16_t ps_cpu_err;    /* CPU error register */
+    uint16_t ps_mmr0;       /* memory management register 0 */
+    uint16_t ps_mmr3;       /* memory management register 3 */
+};
+
+struct pdp_panel_packet
+{
+    panel_packet_header header;
+    pdp_panel_state panel_state;
+};
+
+/* NetBSD VAX panel state, as sent by socket/arch/NetBSDVAX */
+struct netbsdvax_panel_state
+{
+    uint32_t ps_address;    /* panel switches - 32-bit address */
+    uint32_t ps_data;       /* panel lamps - 32-bit data */
+};
+
+struct netbsdvax_panel_packet
+{
+    panel_packet_header header;
+    netbsdvax_panel_state panel_state;
+};
+
+/* NetBSD x64 clock interrupt frame, as sent by socket/arch/NetBSDx64 */
+struct clockframe
+{
+    uint64_t cf_rdi;
+    uint64_t cf_rsi;
+    uint64_t cf_rdx;
+    uint64_t cf_rcx;
+    uint64_t cf_r8;
+    uint64_t cf_r9;
+    uint64_t cf_r10;
+    uint64_t cf_r11;
+    uint64_t cf_r12;
+    uint64_t cf_r13;
+    uint64_t cf_r14;
+    uint64_t cf_r15;
+    uint64_t cf_rbp;
+    uint64_t cf_rbx;
+    uint64_t cf_rax;
+    uint64_t cf_gs;
+    uint64_t cf_fs;
+    uint64_t cf_es;
+    uint64_t cf_ds;
+    uint64_t cf_trapno;     /* trap type (always T_PROTFLT for clock interrupts, but unused here) */
+    uint64_t cf_err;        /* error code (0 for clock interrupts) */
+    uint64_t cf_rip;        /* instruction pointer at interrupt */
+    uint64_t cf_cs;         /* code segment at interrupt */
+    uint64_t cf_rflags;     /* flags register at interrupt */
+    uint64_t cf_rsp;        /* stack pointer at interrupt */
+    uint64_t cf_ss;         /* stack segment at interrupt */
+};
+
+/* NetBSD x64 Panel structure */
+struct netbsdx64_panel_state
+{
+    struct clockframe ps_frame;        /* panel switches - NetBSD clockframe structure */
+};
+
+/* NetBSD x64 Panel packet structure */
+struct netbsdx64_panel_packet
+{
+    struct panel_packet_header header;
+    struct netbsdx64_panel_state panel_state;
+};
+
+/* Linux x64 registers, as sent by socket/arch/LinuxX64 (layout of the kernel's struct pt_regs) */
+struct linuxx64_regs
+{
+    uint64_t r15;
+    uint64_t r14;
+    uint64_t r13;
+    uint64_t r12;
+    uint64_t rbp;
+    uint64_t rbx;
+    uint64_t r11;
+    uint64_t r10;
+    uint64_t r9;
+    uint64_t r8;
+    uint64_t rax;
+    uint64_t rcx;
+    uint64_t rdx;
+    uint64_t rsi;
+    uint64_t rdi;
+    uint64_t orig_rax;      /* Original RAX before system call */
+    uint64_t rip;           /* instruction pointer */
+    uint64_t cs;            /* code segment */
+    uint64_t eflags;        /* flags register */
+    uint64_t rsp;           /* stack pointer */
+    uint64_t ss;            /* stack segment */
+};
+
+struct linuxx64_panel_state
+{
+    struct linuxx64_regs ps_regs;
+};
+
+struct linuxx64_panel_packet
+{
+    struct panel_packet_header header;
+    struct linuxx64_panel_state panel_state;
+};
+
+/* macOS ARM64 panel state, as sent by socket/arch/macOS */
+struct macos_panel_state
+{
+    uint64_t pc;            /* Program counter */
+    uint64_t sp;            /* Stack pointer */
+    uint64_t fp;            /* Frame pointer */
+    uint64_t lr;            /* Link register */
+    uint64_t x0;            /* First argument/return register */
+    uint64_t x1;            /* Second argument register */
+    uint32_t cpu_usage;     /* CPU usage percentage (0-100) */
+    uint32_t memory_usage;  /* Memory usage percentage (0-100) */
+    uint32_t load_average;  /* Load average * 100 */
+    uint32_t thread_count;  /* Number of threads in current process */
+    uint32_t architecture;  /* Always 1 for ARM64 */
+    uint32_t timestamp;     /* Timestamp of snapshot */
+};
+
+struct macos_panel_packet
+{
+    struct panel_packet_header header;
+    struct macos_panel_state panel_state;
+};
+
+#pragma pack(pop)
+
+// Decoded envelope of a version 1 or version 2 panel packet
+struct panel_packet_info
+{
+    uint8_t version = 1;
+    uint8_t type = 0;               // panel_type
+    uint32_t seq = 0;               // version 2 only; sequence number of the first sample
+    uint32_t timestamp = 0;         // version 2 only; sender time of the first sample
+    uint32_t host_id = 0;           // version 2 only
+    uint16_t cpu = 0;               // version 2 only
+    uint16_t count = 1;             // number of samples, more than one for PP_BATCH packets
+    bool batch = false;
+    std::span<const char> payload;
+
+    // Panel state of sample i
+    std::span<const char> sample(size_t i) const
+    {
+        if (!batch)
+            return payload;
+
+        size_t stride = sample_stride();
+        return payload.subspan(sizeof(panel_batch_header) + i * stride + sizeof(uint32_t), stride - sizeof(uint32_t));
+    }
+
+    // Sender time of sample i, in microseconds (wraps)
+    uint32_t sample_timestamp(size_t i) const
+    {
+        if (!batch)
+            return timestamp;
+
+        uint32_t offset;
+        memcpy(&offset, payload.data() + sizeof(panel_batch_header) + i * sample_stride(), sizeof(offset));
+        return timestamp + offset;
+    }
+
+private:
+    size_t sample_stride() const { return (payload.size() - sizeof(panel_batch_header)) / count; }
+};
@@ -0,0 +1,18 @@
+#pragma once
+#include <cstddef>
+
+// A file of wwwroot as compiled into udproxy. embedwww generates webcontent.cpp, which defines the
+// table below, at build time, so that ETags and gzip copies cost nothing at startup.
+struct EmbeddedAsset
+{
+    const char* path;                   // relative to wwwroot
+    const char* content_type;
+    const char* etag;
+    const unsigned char* body;
+    size_t body_size;
+    const unsigned char* gzip;          // null if compression does not make the body smaller
+    size_t gzip_size;
+};
+
+extern const EmbeddedAsset embedded_assets[];
+extern const size_t embedded_asset_count;
@@ -3,8 +3,13 @@
 WebServer::WebServer(unsigned short port, std::string content_dir)
     : port(port)
     , content_dir(std::move(content_dir))
+    , assets(this->content_dir, std::span(embedded_assets, embedded_asset_count))
 {
     server.loglevel(crow::LogLevel::Warning); // Set log level to Info
+    server.signal_clear();      // main handles the signals
+
+    std::lock_guard guard(config_mutex);
+    update_config();
 }
 
 WebServer::~WebServer()
@@ -14,40 +19,77 @@ WebServer::~WebServer()
 
 void WebServer::run()
 {
-    // Config endpoint
+    // Config endpoint, built by update_config whenever the proxies change
     CROW_ROUTE(server, "/config.json")
-    ([&]
+    ([&](const crow::request& req)
     {
-        // Build the JSON body
-        crow::json::wvalue json;
-        auto& ports_json = json["proxy_ports"];
-        for (const auto& [name, port] : proxy_ports)
-            ports_json[name] = port;
+        std::shared_ptr<const AssetCache::Asset> current;
+        {
+            std::lock_guard guard(config_mutex);
+            current = config;
+        }
+        return serve(req, *current);
+    });
 
-        crow::response res{json.dump()};
+    // Reloads the configuration file, for local administration only as there is no authentication
+    CROW_ROUTE(server, "/admin/reload").methods(crow::HTTPMethod::Post)
+    ([&](const crow::request& req)
+    {
+        if (req.remote_ip_address != "127.0.0.1" && req.remote_ip_address != "::1")
+            return crow::response(403);
+        if (!reload_handler)
+            return crow::response(404);
+
+        std::string reply;
+        int code = reload_handler(reply) ? 200 : 400;
+        crow::response res(code, reply);
         res.set_header("Content-Type", "application/json");
         return res;
     });
 
+    // Samples of any number of proxies, hosts and CPUs over one connection; see multiplexer.hpp
+    CROW_WEBSOCKET_ROUTE(server, "/ws")
+    .onopen([&](crow::websocket::connection& conn)
+    {
+        multiplexer.open(conn);
+    })
+    .onclose([&](crow::websocket::connection& conn, const std::string&, uint16_t)
+    {
+        multiplexer.close(conn);
+    })
+    .onerror([&](crow::websocket::connection& conn, const std::string& msg)
+    {
+        // The socket may already be closed, so the remote address is not available here
+        log_error("WebSocket error: %s", msg.c_str());
+        multiplexer.close(conn);
+    })
+    .onmessage([&](crow::websocket::connection& conn, const std::string& data, bool)
+    {
+        multiplexer.message(conn, data);
+    });
+
     // Root ‑ index.html
     CROW_ROUTE(server, "/")
-    ([&]
+    ([&](const crow::request& req)
     {
-        crow::response res;
-        res.set_static_file_info(content_dir + "/index.html");
-        return res;
+        auto asset = assets.find("");
+        return asset ? serve(req, *asset) : crow::response(404);
     });
 
     // Everything else from static/
     CROW_ROUTE(server, "/<path>")
-    ([&](const std::string& path)
+    ([&](const crow::request& req, const std::string& path)
     {
-        crow::response res;
-        res.set_static_file_info(content_dir + "/" + path);
-        return res;
+        auto asset = assets.find(path);
+        return asset ? serve(req, *asset) : crow::response(404);
     });
 
-    auto server_future = server.port(port).multithreaded().run_async();
+    assets.start();
+
+    server.port(port).multithreaded();
+    if (threads > 0)
+        server.concurrency(uint16_t(threads));
+    auto server_future = server.run_async();
 
     if (server.wait_for_server_start() != std::cv_status::no_timeout)
     {
@@ -55,7 +97,10 @@ void WebServer::run()
         return;
     }
 
-    log_info("HTTP server serving directory '%s' on port %u", content_dir.c_str(), port);
+    if (content_dir.empty())
+        log_info("HTTP server serving built-in content on port %u", port);
+    else
+        log_info("HTTP server serving directory '%s' on port %u", content_dir.c_str(), port);
 
     server_future.wait();
     log_info("HTTP server stopped");
@@ -65,9 +110,90 @@ void WebServer::run()
 void WebServer::stop()
 {
     server.stop();
+    assets.stop();
+}
+
+crow::response WebServer::serve(const crow::request& req, const AssetCache::Asset& asset)
+{
+    // Browsers revalidate every time, and are told nothing changed unless the contents did
+    crow::response res;
+    res.set_header("ETag", asset.etag);
+    res.set_header("Cache-Control", "no-cache");
+    const std::string& if_none_match = req.get_header_value("If-None-Match");
+    if (if_none_match == "*" || if_none_match.find(asset.etag) != std::string::npos)
+    {
+        res.code = 304;
+        return res;
+    }
+
+    res.set_header("Content-Type", asset.content_type);
+    if (!asset.gzip.empty())
+    {
+        res.set_header("Vary", "Accept-Encoding");
+        if (req.get_header_value("Accept-Encoding").find("gzip") != std::string::npos)
+        {
+            res.set_header("Content-Encoding", "gzip");
+            res.body = std::string(asset.gzip);
+            return res;
+        }
+    }
+    res.body = std::string(asset.body);
+    return res;
 }
 
 void WebServer::add_proxy_port(const std::string& proxy_name, unsigned short port)
 {
+    multiplexer.add_proxy(proxy_name);
+
+    std::lock_guard guard(config_mutex);
     proxy_ports[proxy_name] = port;
+    update_config();
+}
+
+void WebServer::remove_proxy_port(const std::string& proxy_name)
+{
+    multiplexer.remove_proxy(proxy_name);
+
+    std::lock_guard guard(config_mutex);
+    proxy_ports.erase(proxy_name);
+    update_config();
+}
+
+// Called with config_mutex held
+void WebServer::update_config()
+{
+    crow::json::wvalue json;
+    json["schema"] = config_schema;
+
+    // Kept as it was before "proxies", for pages that only need the port
+    auto& ports_json = json["proxy_ports"];
+    for (const auto& [name, port] : proxy_ports)
+        ports_json[name] = port;
+
+    // The streams of each proxy; the paths are relative to http://<host>:<port>, and ws://<host>:<port>
+    // for the WebSocket
+    auto& proxies_json = json["proxies"];
+    for (const auto& [name, port] : proxy_ports)
+    {
+        auto& proxy_json = proxies_json[name];
+        proxy_json["port"] = port;
+        proxy_json["websocket"] = "/";
+        proxy_json["history"] = "/history";
+        proxy_json["streams"] = "/streams.json";
+        proxy_json["metrics"] = "/metrics.json";
+    }
+    json["multiplexer"] = "/ws";
+
+    // The packet versions the proxies accept and the panel types they know, see types.hpp
+    auto& protocol_json = json["protocol"];
+    protocol_json["versions"] = std::vector<crow::json::wvalue>{1, 2};
+    protocol_json["batch"] = true;
+    auto& types_json = protocol_json["panel_types"];
+    types_json["pdp1170"] = uint32_t(PANEL_PDP1170);
+    types_json["vax"] = uint32_t(PANEL_VAX);
+    types_json["netbsdx64"] = uint32_t(PANEL_NETBSDX64);
+    types_json["macos"] = uint32_t(PANEL_MACOS);
+    types_json["linuxx64"] = uint32_t(PANEL_LINUXX64);
+
+    config = AssetCache::make_asset("config.json", json.dump());
 }
@@ -1,22 +1,45 @@
 #pragma once
 #include "logging.hpp"
+#include "multiplexer.hpp"
+#include "assetcache.hpp"
+#include "types.hpp"
 #include <string>
 #include <memory>
 #include <thread>
+#include <mutex>
+#include <functional>
 #define CROW_ENABLE_COMPRESSION 1
 #include "crow_all.h"
 
 class WebServer : public Loggable {
 public:
+    // Serves content_dir, or the content built into udproxy if it is empty
     WebServer(unsigned short port, std::string content_dir);
     virtual ~WebServer();
     void run(); // blocks
     void stop();
     const char* module_name() const override { return "WebServer"; };
     void add_proxy_port(const std::string& proxy_name, unsigned short port);
+    void remove_proxy_port(const std::string& proxy_name);
+    // Called for POST /admin/reload; returns false if the reload failed, and a JSON reply either way
+    void set_reload_handler(std::function<bool(std::string&)> handler) { reload_handler = std::move(handler); }
+    StreamMultiplexer& get_multiplexer() { return multiplexer; }
+    // Threads serving HTTP and the multiplexed WebSocket, 0 for one per CPU; call before run()
+    void set_threads(unsigned count) { threads = count; }
 protected:
+    static constexpr int config_schema = 2;    // version of the /config.json layout
+
+    static crow::response serve(const crow::request& req, const AssetCache::Asset& asset);
+    void update_config();
+
     unsigned short port;
+    unsigned threads = 0;
     std::string content_dir;
     crow::SimpleApp server;
+    StreamMultiplexer multiplexer;
+    AssetCache assets;
+    std::mutex config_mutex;            // guards proxy_ports and config
     std::map<std::string, unsigned short> proxy_ports;
+    std::shared_ptr<const AssetCache::Asset> config;
+    std::function<bool(std::string&)> reload_handler;
 };
@@ -0,0 +1,586 @@
+// wsbench.cpp - WebSocket fan-out benchmark for the panel proxies
+//
+// Opens a large number of WebSocket connections to a proxy port, drives the proxy with the load
+// generator in probe mode, and measures what each simulated browser receives: delivery rate, drops
+// (gaps in the per-host sequence numbers) and end-to-end latency (from the send timestamp embedded
+// in each frame). The proxy's RSS and CPU use are sampled from /proc. Results are written as JSON.
+//
+// Linux only: uses epoll, /proc and CLOCK_MONOTONIC timestamps shared with the load generator.
+
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <string_view>
+#include <vector>
+
+extern char** environ;
+
+namespace
+{
+    struct Options
+    {
+        std::string server_ip = "127.0.0.1";
+        unsigned short port = 4002;         // NetBSD VAX proxy: its frames carry the probe fields
+        unsigned clients = 1000;
+        unsigned hosts = 1;
+        double rate = 60.0;
+        unsigned duration = 10;
+        pid_t proxy_pid = 0;
+        std::string loadgen = "./loadgen";
+        std::string output;
+    };
+
+    constexpr unsigned max_hosts = 256;     // host index is carried in the top 8 bits of ps_address
+
+    uint64_t now_us()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return uint64_t(ts.tv_sec) * 1000000ull + ts.tv_nsec / 1000;
+    }
+
+    // A minimal WebSocket client: just enough of RFC 6455 to receive unmasked text frames from the
+    // proxy and answer pings.
+    struct Client
+    {
+        enum class State { Connecting, Handshaking, Open, Closed };
+
+        int fd = -1;
+        State state = State::Connecting;
+        std::string buffer;
+        uint64_t frames = 0;
+        uint64_t drops = 0;
+        uint64_t first_frame_us = 0;
+        uint64_t last_frame_us = 0;
+        int32_t last_sequence[max_hosts];
+
+        Client() { std::fill(std::begin(last_sequence), std::end(last_sequence), -1); }
+    };
+
+    struct Results
+    {
+        std::vector<uint32_t> latencies_us;
+        uint64_t frames = 0;
+        uint64_t drops = 0;
+        uint64_t reordered = 0;
+        uint64_t malformed = 0;
+        uint64_t start_us = 0;          // when the load generator was started, 0 before
+    };
+
+    struct ProcessSample
+    {
+        bool valid = false;
+        uint64_t cpu_ticks = 0;
+        uint64_t rss_kb = 0;
+    };
+
+    ProcessSample sample_process(pid_t pid)
+    {
+        ProcessSample sample;
+        if (pid <= 0)
+            return sample;
+
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/%d/stat", int(pid));
+        FILE* fp = fopen(path, "r");
+        if (fp == nullptr)
+            return sample;
+
+        // Fields after the parenthesized command name; utime and stime are fields 14 and 15
+        char line[1024];
+        bool ok = fgets(line, sizeof(line), fp) != nullptr;
+        fclose(fp);
+        const char* rest = ok ? strrchr(line, ')') : nullptr;
+        if (rest == nullptr)
+            return sample;
+
+        unsigned long utime = 0, stime = 0;
+        if (sscanf(rest + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)
+            return sample;
+        sample.cpu_ticks = utime + stime;
+
+        snprintf(path, sizeof(path), "/proc/%d/status", int(pid));
+        fp = fopen(path, "r");
+        if (fp == nullptr)
+            return sample;
+        while (fgets(line, sizeof(line), fp))
+        {
+            if (sscanf(line, "VmRSS: %lu", &utime) == 1)
+                sample.rss_kb = utime;
+        }
+        fclose(fp);
+
+        sample.valid = true;
+        return sample;
+    }
+
+    void raise_fd_limit(unsigned needed)
+    {
+        rlimit limit;
+        if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < needed + 64)
+        {
+            limit.rlim_cur = std::min<rlim_t>(limit.rlim_max, needed + 64);
+            setrlimit(RLIMIT_NOFILE, &limit);
+        }
+    }
+
+    bool send_all(int fd, const char* data, size_t size)
+    {
+        while (size > 0)
+        {
+            ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            data += n;
+            size -= size_t(n);
+        }
+        return true;
+    }
+
+    // Client frames must be masked; a zero mask keeps the payload unchanged
+    void send_control_frame(Client& client, uint8_t opcode, const std::string& payload)
+    {
+        std::string frame;
+        frame += char(0x80 | opcode);
+        frame += char(0x80 | std::min<size_t>(payload.size(), 125));
+        frame.append(4, '\0');
+        frame.append(payload, 0, 125);
+        send_all(client.fd, frame.data(), frame.size());
+    }
+
+    void record_frame(Client& client, const char* text, size_t size, Results& results)
+    {
+        uint64_t now = now_us();
+        std::string_view json(text, size);
+
+        // Frames look like {"address":N,"data":M}; numbers are always followed by ',' or '}'
+        size_t address_pos = json.find("\"address\":");
+        size_t data_pos = json.find("\"data\":");
+        if (address_pos == std::string_view::npos || data_pos == std::string_view::npos)
+        {
+            results.malformed++;
+            return;
+        }
+
+        uint32_t address = uint32_t(strtoul(text + address_pos + 10, nullptr, 10));
+        uint32_t sent_us = uint32_t(strtoul(text + data_pos + 7, nullptr, 10));
+        unsigned host = address >> 24;
+        int32_t sequence = int32_t(address & 0xffffff);
+
+        // A proxy that already has history sends it on connect, which may be arbitrarily old and says
+        // nothing about latency or drops; only frames sent since the run started count
+        uint32_t latency_us = uint32_t(now) - sent_us;
+        if (results.start_us == 0 || latency_us > now - results.start_us)
+            return;
+
+        results.latencies_us.push_back(latency_us);
+        results.frames++;
+        client.frames++;
+        if (client.first_frame_us == 0)
+            client.first_frame_us = now;
+        client.last_frame_us = now;
+
+        int32_t& last = client.last_sequence[host];
+        if (last >= 0)
+        {
+            int32_t gap = (sequence - last) & 0xffffff;
+            if (gap == 0 || gap > 0x800000)
+                results.reordered++;
+            else
+            {
+                client.drops += uint64_t(gap - 1);
+                results.drops += uint64_t(gap - 1);
+            }
+        }
+        if (last < 0 || ((sequence - last) & 0xffffff) < 0x800000)
+            last = sequence;
+    }
+
+    // Parse as many complete frames as the buffer holds; returns false if the connection should close
+    bool process_frames(Client& client, Results& results)
+    {
+        size_t pos = 0;
+        auto& buf = client.buffer;
+
+        while (buf.size() - pos >= 2)
+        {
+            uint8_t opcode = uint8_t(buf[pos]) & 0x0f;
+            uint64_t length = uint8_t(buf[pos + 1]) & 0x7f;
+            size_t header = 2;
+
+            if (length == 126)
+            {
+                if (buf.size() - pos < 4)
+                    break;
+                length = (uint64_t(uint8_t(buf[pos + 2])) << 8) | uint8_t(buf[pos + 3]);
+                header = 4;
+            }
+            else if (length == 127)
+            {
+                if (buf.size() - pos < 10)
+                    break;
+                length = 0;
+                for (int i = 0; i < 8; ++i)
+                    length = (length << 8) | uint8_t(buf[pos + 2 + i]);
+                header = 10;
+            }
+
+            if (buf.size() - pos < header + length)
+                break;
+
+            const char* payload = buf.data() + pos + header;
+            switch (opcode)
+            {
+                case 0x1:   // text
+                    record_frame(client, payload, length, results);
+                    break;
+                case 0x8:   // close
+                    return false;
+                case 0x9:   // ping
+                    send_control_frame(client, 0xA, std::string(payload, length));
+                    break;
+                default:
+                    break;
+            }
+
+            pos += header + length;
+        }
+
+        buf.erase(0, pos);
+        return true;
+    }
+
+    void handle_readable(Client& client, Results& results)
+    {
+        char chunk[16384];
+        for (;;)
+        {
+            ssize_t n = recv(client.fd, chunk, sizeof(chunk), 0);
+            if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+            {
+                client.state = Client::State::Closed;
+                return;
+            }
+            if (n < 0)
+                return;
+
+            client.buffer.append(chunk, size_t(n));
+
+            if (client.state == Client::State::Handshaking)
+            {
+                size_t end = client.buffer.find("\r\n\r\n");
+                if (end == std::string::npos)
+                    continue;
+                if (client.buffer.compare(0, 12, "HTTP/1.1 101") != 0)
+                {
+                    client.state = Client::State::Closed;
+                    return;
+                }
+                client.buffer.erase(0, end + 4);
+                client.state = Client::State::Open;
+            }
+
+            if (client.state == Client::State::Open && !process_frames(client, results))
+            {
+                client.state = Client::State::Closed;
+                return;
+            }
+        }
+    }
+
+    void handle_connected(Client& client, const Options& options)
+    {
+        int error = 0;
+        socklen_t len = sizeof(error);
+        getsockopt(client.fd, SOL_SOCKET, SO_ERROR, &error, &len);
+        if (error != 0)
+        {
+            client.state = Client::State::Closed;
+            return;
+        }
+
+        std::string request =
+            "GET / HTTP/1.1\r\n"
+            "Host: " + options.server_ip + ":" + std::to_string(options.port) + "\r\n"
+            "Upgrade: websocket\r\n"
+            "Connection: Upgrade\r\n"
+            "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+            "Sec-WebSocket-Version: 13\r\n\r\n";
+
+        client.state = send_all(client.fd, request.data(), request.size())
+            ? Client::State::Handshaking : Client::State::Closed;
+    }
+
+    pid_t start_loadgen(const Options& options)
+    {
+        std::vector<std::string> args = {
+            options.loadgen, "-T", "-t", "vax",
+            "-s", options.server_ip,
+            "-p", "vax=" + std::to_string(options.port),
+            "-k", std::to_string(options.hosts),
+            "-r", std::to_string(options.rate),
+            "-d", std::to_string(options.duration),
+        };
+
+        std::vector<char*> argv;
+        for (auto& arg : args)
+            argv.push_back(arg.data());
+        argv.push_back(nullptr);
+
+        // Keep the load generator's per-second report out of the JSON on stdout
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+
+        pid_t pid = 0;
+        int error = posix_spawn(&pid, options.loadgen.c_str(), &actions, nullptr, argv.data(), environ);
+        posix_spawn_file_actions_destroy(&actions);
+        if (error != 0)
+        {
+            fprintf(stderr, "Cannot start %s: %s\n", options.loadgen.c_str(), strerror(error));
+            return -1;
+        }
+
+        return pid;
+    }
+
+    double percentile(std::vector<uint32_t>& values, double fraction)
+    {
+        if (values.empty())
+            return 0;
+        size_t index = std::min(values.size() - 1, size_t(fraction * double(values.size())));
+        std::nth_element(values.begin(), values.begin() + index, values.end());
+        return values[index];
+    }
+
+    void usage(const char* progname)
+    {
+        printf("Usage: %s [-s server_ip] [-p port] [-c clients] [-k hosts] [-r rate] [-d seconds] [-P proxy_pid] [-L loadgen] [-o file]\n", progname);
+        printf("  -s server_ip   IP address of the proxy (default: 127.0.0.1)\n");
+        printf("  -p port        UDP/WebSocket port of a NetBSD VAX proxy (default: 4002)\n");
+        printf("  -c clients     WebSocket connections to open (default: 1000)\n");
+        printf("  -k hosts       simulated sending hosts, at most %u (default: 1)\n", max_hosts);
+        printf("  -r rate        frames per second per host (default: 60)\n");
+        printf("  -d seconds     length of the measurement (default: 10)\n");
+        printf("  -P proxy_pid   sample RSS and CPU of this process (default: none)\n");
+        printf("  -L loadgen     path to the load generator (default: ./loadgen)\n");
+        printf("  -o file        write the JSON results to a file instead of stdout\n");
+        printf("  -h             Show this help\n");
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    int c;
+
+    while ((c = getopt(argc, argv, "s:p:c:k:r:d:P:L:o:h")) != -1)
+    {
+        switch (c)
+        {
+        case 's': options.server_ip = optarg; break;
+        case 'p': options.port = (unsigned short)atoi(optarg); break;
+        case 'c': options.clients = unsigned(atoi(optarg)); break;
+        case 'k': options.hosts = std::clamp(unsigned(atoi(optarg)), 1u, max_hosts); break;
+        case 'r': options.rate = atof(optarg); break;
+        case 'd': options.duration = std::max(1, atoi(optarg)); break;
+        case 'P': options.proxy_pid = pid_t(atoi(optarg)); break;
+        case 'L': options.loadgen = optarg; break;
+        case 'o': options.output = optarg; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    raise_fd_limit(options.clients);
+
+    int epfd = epoll_create1(0);
+    std::vector<Client> clients(options.clients);
+    Results results;
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(options.port);
+    inet_pton(AF_INET, options.server_ip.c_str(), &addr.sin_addr);
+
+    // Open all connections up front
+    for (size_t i = 0; i < clients.size(); ++i)
+    {
+        Client& client = clients[i];
+        client.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (client.fd < 0)
+        {
+            client.state = Client::State::Closed;
+            continue;
+        }
+
+        int one = 1;
+        setsockopt(client.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        if (connect(client.fd, (sockaddr*)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS)
+        {
+            client.state = Client::State::Closed;
+            continue;
+        }
+
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLOUT;
+        ev.data.u64 = i;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, client.fd, &ev);
+    }
+
+    auto pump = [&](int timeout_ms)
+    {
+        epoll_event events[512];
+        int n = epoll_wait(epfd, events, 512, timeout_ms);
+        for (int i = 0; i < n; ++i)
+        {
+            Client& client = clients[events[i].data.u64];
+            if (client.state == Client::State::Connecting && (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+            {
+                handle_connected(client, options);
+                epoll_event ev{};
+                ev.events = EPOLLIN;
+                ev.data.u64 = events[i].data.u64;
+                epoll_ctl(epfd, EPOLL_CTL_MOD, client.fd, &ev);
+            }
+            if (client.state != Client::State::Connecting && client.state != Client::State::Closed
+                && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+                handle_readable(client, results);
+            if (client.state == Client::State::Closed && client.fd >= 0)
+            {
+                epoll_ctl(epfd, EPOLL_CTL_DEL, client.fd, nullptr);
+                close(client.fd);
+                client.fd = -1;
+            }
+        }
+    };
+
+    // Wait (up to 10 s) for all handshakes to complete
+    uint64_t deadline = now_us() + 10000000;
+    auto pending = [&]()
+    {
+        return std::count_if(clients.begin(), clients.end(), [](const Client& c)
+        {
+            return c.state == Client::State::Connecting || c.state == Client::State::Handshaking;
+        });
+    };
+    while (pending() > 0 && now_us() < deadline)
+        pump(100);
+
+    size_t connected = std::count_if(clients.begin(), clients.end(),
+                                     [](const Client& c) { return c.state == Client::State::Open; });
+    fprintf(stderr, "%zu of %u WebSocket clients connected\n", connected, options.clients);
+
+    // Drive the proxy and measure until the load generator finishes, plus a short grace period
+    ProcessSample before = sample_process(options.proxy_pid);
+    uint64_t max_rss_kb = before.rss_kb;
+    uint64_t start = now_us();
+    uint64_t next_sample = start + 1000000;
+    results.start_us = start;
+
+    pid_t loadgen = start_loadgen(options);
+    if (loadgen < 0)
+        return 1;
+
+    uint64_t stop_at = 0;
+    for (;;)
+    {
+        pump(50);
+
+        uint64_t now = now_us();
+        if (now >= next_sample)
+        {
+            next_sample += 1000000;
+            max_rss_kb = std::max(max_rss_kb, sample_process(options.proxy_pid).rss_kb);
+        }
+
+        if (stop_at == 0 && waitpid(loadgen, nullptr, WNOHANG) == loadgen)
+            stop_at = now + 500000;
+        if (stop_at != 0 && now >= stop_at)
+            break;
+    }
+
+    uint64_t elapsed_us = now_us() - start;
+    ProcessSample after = sample_process(options.proxy_pid);
+    max_rss_kb = std::max(max_rss_kb, after.rss_kb);
+
+    // Per-client delivery rates over the measurement window
+    std::vector<uint32_t> rates;
+    uint64_t expected = 0;
+    for (auto& client : clients)
+    {
+        if (client.frames == 0 && client.state != Client::State::Open)
+            continue;
+        // Measured between the client's first and last frame, so connection setup and the grace
+        // period after the load generator stops do not count against it
+        uint64_t window_us = client.last_frame_us - client.first_frame_us;
+        rates.push_back(client.frames > 1 && window_us > 0 ? uint32_t((client.frames - 1) * 1000000ull / window_us) : 0);
+        expected += client.frames + client.drops;
+    }
+
+    double drop_rate = expected ? double(results.drops) / double(expected) : 0.0;
+    uint32_t rate_min = rates.empty() ? 0 : *std::min_element(rates.begin(), rates.end());
+    uint32_t rate_max = rates.empty() ? 0 : *std::max_element(rates.begin(), rates.end());
+    double rate_p50 = percentile(rates, 0.50);
+
+    double latency_p50 = percentile(results.latencies_us, 0.50);
+    double latency_p99 = percentile(results.latencies_us, 0.99);
+    double latency_p999 = percentile(results.latencies_us, 0.999);
+    uint32_t latency_max = results.latencies_us.empty() ? 0
+        : *std::max_element(results.latencies_us.begin(), results.latencies_us.end());
+
+    FILE* out = options.output.empty() ? stdout : fopen(options.output.c_str(), "w");
+    if (out == nullptr)
+    {
+        perror(options.output.c_str());
+        return 1;
+    }
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"config\": {\"server\": \"%s\", \"port\": %u, \"clients\": %u, \"hosts\": %u, \"rate\": %g, \"duration_s\": %u},\n",
+            options.server_ip.c_str(), options.port, options.clients, options.hosts, options.rate, options.duration);
+    fprintf(out, "  \"clients\": {\"connected\": %zu, \"failed\": %zu},\n", connected, size_t(options.clients) - connected);
+    fprintf(out, "  \"frames\": {\"received\": %llu, \"dropped\": %llu, \"reordered\": %llu, \"malformed\": %llu, \"drop_rate\": %.6f},\n",
+            (unsigned long long)results.frames, (unsigned long long)results.drops,
+            (unsigned long long)results.reordered, (unsigned long long)results.malformed, drop_rate);
+    fprintf(out, "  \"delivery_rate_fps\": {\"expected_per_client\": %g, \"min\": %u, \"p50\": %g, \"max\": %u},\n",
+            options.rate * options.hosts, rate_min, rate_p50, rate_max);
+    fprintf(out, "  \"latency_us\": {\"p50\": %g, \"p99\": %g, \"p999\": %g, \"max\": %u},\n",
+            latency_p50, latency_p99, latency_p999, latency_max);
+
+    if (before.valid && after.valid)
+    {
+        double cpu_seconds = double(after.cpu_ticks - before.cpu_ticks) / double(sysconf(_SC_CLK_TCK));
+        fprintf(out, "  \"proxy\": {\"pid\": %d, \"rss_kb_max\": %llu, \"cpu_percent\": %.1f}\n",
+                int(options.proxy_pid), (unsigned long long)max_rss_kb, 100.0 * cpu_seconds * 1e6 / double(elapsed_us));
+    }
+    else
+        fprintf(out, "  \"proxy\": null\n");
+
+    fprintf(out, "}\n");
+    if (out != stdout)
+        fclose(out);
+
+    return 0;
+}
@@ -24,6 +24,8 @@ var panel = {
     rotary1: 0, // rotary switch 1 position
     statusId: [], //  DOM id's for statusLights
     statusLights: 0x3ffffff, // current state of statusLights (s0-s25)
+    addressGlow: '', // intensities of addressLights last shown, when the proxy sends the afterglow
+    displayGlow: '', // intensities of displayLights last shown
     old_state: null, // previous state of panel
     state: null, // current state of panel, as received from WebSocket
     step: 0 // S Inst / S Bus switch position
@@ -64,6 +66,13 @@ function initPanel(idArray, idName, idCount) {
     return initVal;
 }
 
+// Bits of a lamp register that were lit in any of the states since the previous one, if the proxy
+// summarized the states it skipped, or else in the current state
+function litBits(state, name) {
+    "use strict";
+    return state.activity && state.activity[name] ? state.activity[name].or : state[name];
+}
+
 function setPanelState(newState) {
     "use strict";
     panel.old_state = panel.state; // Save old state
@@ -79,6 +88,8 @@ function setPanelState(newState) {
 // The updateLights() function should be executed every time any state changes that
 // may be relevant for the panel lights, to calculate the three light bit mask values
 // and then set the appropriate light visibility to either hidden or visible.
+// When the proxy sends the afterglow (?glow=1), the address and display lights
+// are instead set to how long they were lit in the last frame.
 //
 // statusLights:         25 24 23 22 21 20 19 18 17 16 15 14 13 12 11 10  9  8  7  6  5  4  3  2  1  0
 //                      |  rotary1  |       rotary0         | PAR |PE AE Rn Pa Ma Us Su Ke Da 32 64 VAX
@@ -113,16 +124,27 @@ function updateLights() {
         }
     }
 
+    function updateGlow(levels, oldLevels, idArray) { // Set lights to levels, a hex digit each, MSB first
+        for (let id = 0; id < idArray.length && id < levels.length; id++) {
+            let level = levels[levels.length - 1 - id];
+            if (level !== oldLevels[oldLevels.length - 1 - id]) {
+                idArray[id].visibility = 'visible';
+                idArray[id].opacity = String(parseInt(level, 16) / 15);
+                idArray[id].transition = '';
+            }
+        }
+    }
+
     if (panel.lampTest) {
         addressLights = 0xffffffff;
         displayLights = 0xffffffff;
         statusLights = 0x3ffffff;
     } else if (panel.state) {
-        addressLights = panel.state.address & 0xffffffff; // Mask to 32 bits
-        displayLights = panel.state.data & 0xffffffff; // Mask to 32 bits
+        addressLights = litBits(panel.state, 'address') & 0xffffffff; // Mask to 32 bits
+        displayLights = litBits(panel.state, 'data') & 0xffffffff; // Mask to 32 bits
 
         // We assume that the data space was accessed if the data field has changed
-        let data_space = !panel.old_state || (displayLights ^ (panel.old_state.data & 0xffffffff)) !== 0;
+        let data_space = !panel.old_state || ((panel.state.data ^ panel.old_state.data) & 0xffffffff) !== 0;
 
         // PE AE Rn Pa Ma Us Su Ke Da 32 64 VAX
         statusLights |=
@@ -139,13 +161,25 @@ function updateLights() {
             | (panel.state.vax ? 0x1 : 0); // VAX mode
     }
 
-    if (addressLights !== panel.addressLights) {
-        updatePanel(panel.addressLights, addressLights, panel.addressId);
+    // After the glow the lights are in between, so all of them are set when it stops
+    let glow = !panel.lampTest && panel.state && panel.state.glow;
+    if (glow && glow.address) {
+        updateGlow(glow.address, panel.addressGlow, panel.addressId);
+        panel.addressGlow = glow.address;
+        panel.addressLights = null;
+    } else if (addressLights !== panel.addressLights) {
+        updatePanel(panel.addressLights ?? (~addressLights & 0xffffffff), addressLights, panel.addressId);
         panel.addressLights = addressLights;
+        panel.addressGlow = '';
     }
-    if (displayLights !== panel.displayLights) {
-        updatePanel(panel.displayLights, displayLights, panel.displayId);
+    if (glow && glow.data) {
+        updateGlow(glow.data, panel.displayGlow, panel.displayId);
+        panel.displayGlow = glow.data;
+        panel.displayLights = null;
+    } else if (displayLights !== panel.displayLights) {
+        updatePanel(panel.displayLights ?? (~displayLights & 0xffffffff), displayLights, panel.displayId);
         panel.displayLights = displayLights;
+        panel.displayGlow = '';
     }
     if (statusLights !== panel.statusLights) {
         updatePanel(panel.statusLights, statusLights, panel.statusId);
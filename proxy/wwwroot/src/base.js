@@ -9,6 +9,10 @@ var statusLabel;
  * @param {object} [opts]
  * @param {number} [opts.maxQueue=100]
  *                                – Maximum queued messages
+ * @param {number} [opts.rate]    – States per second to ask the proxy for, unless the page URL has ?rate=
+ * @param {boolean} [opts.activity]
+ *                                – Ask for a summary of the lamps in the states skipped for the rate
+ * @param {boolean} [opts.glow]   – Ask for the afterglow of the lamps
  * @returns {WebSocket}
  */
 function openWebSocket(handleMessage, opts = {}) {
@@ -106,8 +110,22 @@ function openWebSocket(handleMessage, opts = {}) {
             if (panelKey.includes('.'))
                 panelKey = pathParts[pathParts.length - 2];
 
-            const port = cfg.proxy_ports[panelKey];
-            const wsUrl = `ws://${location.hostname}:${port}/`;
+            // A ?proxy= parameter in the page URL selects another proxy of the same type as the page,
+            // ?host= and ?cpu= parameters select the stream of one sender and one of its CPUs, and
+            // ?rate= caps the states per second (0 for all of them), and ?activity= and ?glow= turn the
+            // lamp summaries on or off; the page's own settings apply to what the URL leaves out
+            const params = new URLSearchParams(location.search);
+            const port = cfg.proxy_ports[params.get('proxy') || panelKey];
+            const filter = new URLSearchParams();
+            for (const name of ['host', 'cpu', 'rate', 'activity', 'glow']) {
+                if (params.get(name) !== null)
+                    filter.set(name, params.get(name));
+                else if (opts[name])
+                    filter.set(name, opts[name] === true ? 1 : opts[name]);
+            }
+            // URLSearchParams.size is missing in older browsers
+            const query = filter.toString();
+            const wsUrl = `ws://${location.hostname}:${port}/` + (query ? '?' + query : '');
             ws = new WebSocket(wsUrl);
 
             ws.onopen = () => {
@@ -74,11 +74,26 @@ int main(int argc, char *argv[])
     int kmem_fd;
     
     /* Parse command line arguments */
-    while ((c = getopt(argc, argv, "s:h")) != -1) {
+    while ((c = getopt(argc, argv, "s:b:m:k:t:i:h")) != -1) {
         switch (c) {
         case 's':
             server_ip = optarg;
             break;
+        case 'b':
+            batch_samples = atoi(optarg);
+            break;
+        case 'm':
+            send_queue = atoi(optarg);
+            break;
+        case 'k':
+            heartbeat_seconds = atoi(optarg);
+            break;
+        case 't':
+            multicast_ttl = atoi(optarg);
+            break;
+        case 'i':
+            multicast_if = optarg;
+            break;
         case 'h':
         case '?':
             usage(argv[0]);
@@ -114,6 +129,8 @@ int main(int argc, char *argv[])
     /* Send frames continuously */
     send_frames(sockfd, &server_addr);
     
+    /* Send whatever is still queued */
+    panel_flush(sockfd, 0);
     close(sockfd);
     close(kmem_fd);
     return 0;
@@ -207,7 +224,13 @@ void send_frames(int sockfd, struct sockaddr_in *server_addr)
 {
     struct pdp_panel_state panel;
     struct pdp_panel_packet packet;
+    struct panel_batch batch;
     int frame_count = 0;
+    unsigned long seq = 0;          /* packets sent plus kernel frames missed */
+    unsigned int panel_seq, last_panel_seq, missed;
+    struct pdp_panel_state last_sent;
+    struct panel_change change;
+    int sent;
     static void *panel_addr = NULL;
     static int kmem_fd = -1;
     int send_result;
@@ -260,6 +283,12 @@ void send_frames(int sockfd, struct sockaddr_in *server_addr)
     
     printf("Starting packet transmission loop...\n");
     
+    init_packet_header(&packet.header, sizeof(struct pdp_panel_state), PANEL_PDP1170);
+    batch_init(&batch, sizeof(struct pdp_panel_state), PANEL_PDP1170);
+    change_init(&change, (char *)&last_sent, sizeof(last_sent));
+    /* Start counting missed frames from the kernel's current panel_seq */
+    last_panel_seq = wait_for_panel();
+
     while (1) {
         /* Read panel structure from kernel memory */
         if (read_panel_from_kmem(kmem_fd, panel_addr, &panel) < 0) {
@@ -267,23 +296,42 @@ void send_frames(int sockfd, struct sockaddr_in *server_addr)
             break;
         }
         
-        /* Populate packet structure */
-        packet.header.pp_byte_count = sizeof(struct pdp_panel_state);
-        packet.header.pp_byte_flags = PANEL_PDP1170;  /* Set panel type flag */
-        packet.panel_state = panel;
-        
-        /* Send panel packet via UDP */
-        send_result = sendto(sockfd, &packet, sizeof(packet), 0,
-                            (struct sockaddr *)server_addr, sizeof(*server_addr));
+        sent = state_changed(&change, (char *)&panel);
+        if (!sent) {
+            /* Unchanged, so nothing to send; don't hold back what is batched though */
+            send_result = batch_flush_stale(sockfd, &batch, 0);
+        } else if (batch.max_count > 1) {
+            /* Queue the sample; the batch goes out once it is full */
+            send_result = batch_queue(sockfd, &batch, (char *)&panel, seq, 0);
+        } else {
+            /* Populate packet structure */
+            stamp_packet_header(&packet.header, seq);
+            packet.panel_state = panel;
+            
+            /* Send panel packet via UDP */
+            send_result = panel_send(sockfd, (char *)&packet, sizeof(packet), 0);
+        }
+        /* Don't hold back packets queued for sendmmsg() either */
+        if (send_result >= 0)
+            send_result = panel_flush_stale(sockfd, 0);
         if (send_result < 0) {
-            fprintf(stderr, "sendto failed after %d packets (errno=%d): ", frame_count, errno);
+            fprintf(stderr, "send failed after %d packets (errno=%d): ", frame_count, errno);
             perror("");
             break;
         }
         
         frame_count++;
         
-        /* Wait for next frame time */
-        wait_for_panel();
+        /*
+         * Wait for next frame time. The kernel returns its panel_seq, so frames
+         * the client missed show up at the proxy as gaps in the sequence.
+         * Frames skipped because they were unchanged do not advance it.
+         */
+        panel_seq = wait_for_panel();
+        missed = (panel_seq - last_panel_seq) & 0xffff;
+        if (missed > 0)
+            missed--;
+        seq += missed + sent;
+        last_panel_seq = panel_seq;
     }
 }
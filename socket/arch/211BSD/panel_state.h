@@ -22,7 +22,7 @@ struct pdp_panel_state {
 
 /* PDP-11 Panel packet structure */
 struct pdp_panel_packet {
-    struct panel_packet_header header;
+    struct panel_packet_header_v2 header;
     struct pdp_panel_state panel_state;
 };
 
@@ -1,9 +1,10 @@
 /*
  * client.c - Linux x64 panel client
- * Uses ptrace APIs to capture CPU state and proc/sys filesystem for system information
- * Sends panel data frames to server 30 times per second
+ * Reads CPU state from the register page the kprobe module shares through /proc/panel_regs
+ * Sends a panel data frame for every new snapshot, at most FRAMES_PER_SECOND times per second
  */
 
+#define _GNU_SOURCE     /* For sendmmsg() */
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/time.h>
@@ -11,6 +12,8 @@
 #include <sys/ptrace.h>
 #include <sys/user.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
+#include <poll.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
@@ -18,6 +21,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <time.h>
 
@@ -26,15 +30,24 @@ extern char *optarg;
 extern int optind, optopt;
 
 /* Include common functions */
-#define SERVER_PORT 4000
+#define SERVER_PORT 4003
 #include "../../common.c"
 
 /* Include panel state definitions */
 #include "panel_state.h"
+#include "panel_regs.h"
+
+/* Per-CPU register slots published by the kernel module, mapped read-only */
+static const volatile struct panel_regs_area *regs_area;
+static unsigned int regs_cpus;
+static int regs_fd;             /* polled for new snapshots */
 
 /* Function prototypes */
-int capture_cpu_state(struct linuxx64_panel_state *panel);
-void send_frames(int sockfd, struct sockaddr_in *server_addr);
+void map_panel_regs(void);
+int capture_cpu_state(unsigned int cpu, struct linuxx64_panel_state *panel, uint32_t *seq);
+void wait_for_snapshot(void);
+void sleep_until(struct timespec *deadline, long usec);
+void send_frames(int sockfd);
 
 int main(int argc, char *argv[])
 {
@@ -44,11 +57,26 @@ int main(int argc, char *argv[])
     struct sockaddr_in server_addr;
     
     /* Parse command line arguments */
-    while ((c = getopt(argc, argv, "s:h")) != -1) {
+    while ((c = getopt(argc, argv, "s:b:m:k:t:i:h")) != -1) {
         switch (c) {
         case 's':
             server_ip = optarg;
             break;
+        case 'b':
+            batch_samples = atoi(optarg);
+            break;
+        case 'm':
+            send_queue = atoi(optarg);
+            break;
+        case 'k':
+            heartbeat_seconds = atoi(optarg);
+            break;
+        case 't':
+            multicast_ttl = atoi(optarg);
+            break;
+        case 'i':
+            multicast_if = optarg;
+            break;
         case 'h':
         case '?':
             usage(argv[0]);
@@ -58,6 +86,9 @@ int main(int argc, char *argv[])
     
     printf("Linux Panel Client (x64)\n");
     
+    /* Map the kernel module's register page */
+    map_panel_regs();
+    
     /* Create UDP socket and connect to server */
     sockfd = create_udp_socket(server_ip, &server_addr);
     if (sockfd < 0) {
@@ -68,91 +99,219 @@ int main(int argc, char *argv[])
     printf("Packet size: %d bytes\n", (int)sizeof(struct linuxx64_panel_packet));
     
     /* Send panel data frames */
-    send_frames(sockfd, &server_addr);
+    send_frames(sockfd);
     
+    /* Send whatever is still queued */
+    panel_flush(sockfd, 0);
     close(sockfd);
     return 0;
 }
 
-int capture_cpu_state(struct linuxx64_panel_state *panel)
+void map_panel_regs(void)
 {
-    FILE *fp;
-    struct pt_regs *regs = &panel->ps_regs;
-    char buffer[512];
-    int ret;
-    
-    /* Try to read real register data from kernel module */
-    fp = fopen("/proc/panel_regs", "r");
-    if (fp == NULL) {
-        fprintf(stderr, "Error: Cannot access /proc/panel_regs\n");
+    int fd;
+    void *area;
+    
+    fd = open(PANEL_REGS_PATH, O_RDONLY);
+    regs_fd = fd;
+    if (fd < 0) {
+        fprintf(stderr, "Error: Cannot access %s\n", PANEL_REGS_PATH);
         fprintf(stderr, "Please load the kernel module first: sudo make load\n");
         exit(1);
     }
     
-    /* Read the first line to check if data is available */
-    if (fgets(buffer, sizeof(buffer), fp) == NULL) {
-        fprintf(stderr, "Error: Could not read from /proc/panel_regs\n");
-        fclose(fp);
-        exit(1);
+    /* Map the header to find out how many CPU slots there are, then all of them */
+    area = mmap(NULL, sizeof(struct panel_regs_area), PROT_READ, MAP_SHARED, fd, 0);
+    if (area != MAP_FAILED) {
+        regs_area = area;
+        regs_cpus = regs_area->magic == PANEL_REGS_MAGIC ? regs_area->cpus : 0;
+        munmap(area, sizeof(struct panel_regs_area));
+        
+        area = MAP_FAILED;
+        if (regs_cpus > 0)
+            area = mmap(NULL, PANEL_REGS_SIZE(regs_cpus), PROT_READ, MAP_SHARED, fd, 0);
     }
     
-    /* Check if no data has been captured yet */
-    if (strncmp(buffer, "No register data captured yet", 29) == 0) {
-        fclose(fp);
-        /* Return error to retry */
-        return -1;
+    if (area == MAP_FAILED) {
+        fprintf(stderr, "Error: Cannot map %s\n", PANEL_REGS_PATH);
+        fprintf(stderr, "The loaded kernel module may be out of date, reload it: sudo make unload load\n");
+        exit(1);
     }
     
-    /* Parse all registers from the buffer */
-    ret = sscanf(buffer, "RIP=0x%lx RSP=0x%lx RBP=0x%lx RAX=0x%lx RBX=0x%lx RCX=0x%lx RDX=0x%lx RSI=0x%lx RDI=0x%lx R8=0x%lx R9=0x%lx R10=0x%lx R11=0x%lx R12=0x%lx R13=0x%lx R14=0x%lx R15=0x%lx EFLAGS=0x%lx CS=0x%lx SS=0x%lx ORIG_RAX=0x%lx",
-             &regs->rip, &regs->rsp, &regs->rbp, &regs->rax, &regs->rbx, &regs->rcx, &regs->rdx,
-             &regs->rsi, &regs->rdi, &regs->r8, &regs->r9, &regs->r10, &regs->r11, &regs->r12,
-             &regs->r13, &regs->r14, &regs->r15, &regs->eflags, &regs->cs, &regs->ss, &regs->orig_rax);
+    regs_area = area;
+    printf("Capturing %u CPUs\n", regs_cpus);
+}
+
+int capture_cpu_state(unsigned int cpu, struct linuxx64_panel_state *panel, uint32_t *snapshot_seq)
+{
+    const volatile struct panel_regs_slot *slot = &regs_area->slot[cpu];
+    uint32_t seq;
     
-    fclose(fp);
+    /* Sequence count read: retry while the module is writing or wrote in between */
+    do {
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        memcpy(&panel->ps_regs, (const void *)slot->regs, sizeof(panel->ps_regs));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || slot->seq != seq);
     
-    if (ret != 21) {
-        fprintf(stderr, "Error: Could not parse register data (got %d fields)\n", ret);
+    /* Nothing captured on this CPU yet, e.g. because it is offline */
+    if (seq == 0)
         return -1;
-    }
     
+    *snapshot_seq = seq;
     return 0;
 }
 
-void send_frames(int sockfd, struct sockaddr_in *server_addr)
+/*
+ * Block until the kernel module published a new snapshot. A module without
+ * poll support reports the file as always readable, in which case sending is
+ * paced by sleep_until() alone.
+ */
+void wait_for_snapshot(void)
+{
+    struct pollfd pfd;
+    
+    pfd.fd = regs_fd;
+    pfd.events = POLLIN;
+    while (poll(&pfd, 1, -1) < 0) {
+        if (errno != EINTR) {
+            perror("poll " PANEL_REGS_PATH);
+            exit(1);
+        }
+    }
+}
+
+/*
+ * Advance an absolute deadline by usec and sleep until it has passed. Unlike a
+ * relative delay this does not drift; after falling behind by more than one
+ * interval (e.g. while no snapshots came in) it starts over from now rather
+ * than sending a burst.
+ */
+void sleep_until(struct timespec *deadline, long usec)
+{
+    struct timespec now;
+    
+    deadline->tv_nsec += usec * 1000;
+    while (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_nsec -= 1000000000L;
+        deadline->tv_sec++;
+    }
+    
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if ((now.tv_sec - deadline->tv_sec) * 1000000L + (now.tv_nsec - deadline->tv_nsec) / 1000 > usec) {
+        *deadline = now;
+        return;
+    }
+    
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, deadline, NULL) == EINTR)
+        ;
+}
+
+void send_frames(int sockfd)
 {
     struct linuxx64_panel_state panel;
     struct linuxx64_panel_packet packet;
+    struct panel_batch *batches;
+    struct timespec deadline;
+    unsigned long *frame_seq;
+    uint32_t *last_snapshot;
+    uint32_t snapshot;
+    struct linuxx64_panel_state *last_sent;
+    struct panel_change *changes;
+    unsigned int cpu;
+    int fresh;
+    int captured;
+    int max_count;
     int frame_count = 0;
     
+    /* Every CPU is a stream of its own, told apart by pp_cpu, so each needs its own
+     * batch, sequence numbers, record of the last snapshot and copy of the last state it sent */
+    batches = calloc(regs_cpus, sizeof(struct panel_batch));
+    frame_seq = calloc(regs_cpus, sizeof(unsigned long));
+    last_snapshot = calloc(regs_cpus, sizeof(uint32_t));
+    last_sent = calloc(regs_cpus, sizeof(struct linuxx64_panel_state));
+    changes = calloc(regs_cpus, sizeof(struct panel_change));
+    if (batches == NULL || frame_seq == NULL || last_snapshot == NULL ||
+        last_sent == NULL || changes == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+    
+    init_packet_header(&packet.header, sizeof(struct linuxx64_panel_state), PANEL_LINUXX64);
+    for (cpu = 0; cpu < regs_cpus; cpu++) {
+        batch_init(&batches[cpu], sizeof(struct linuxx64_panel_state), PANEL_LINUXX64);
+        batches[cpu].header.pp_cpu = cpu;
+        change_init(&changes[cpu], (char *)&last_sent[cpu], sizeof(struct linuxx64_panel_state));
+    }
+    max_count = batches[0].max_count;
+    
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
     while (1) {
-        /* Capture current CPU state - retry if no data available yet */
-        if (capture_cpu_state(&panel) < 0) {
-            /* Wait a bit and try again */
-            precise_delay(USEC_PER_FRAME);
-            continue;
+        wait_for_snapshot();
+        captured = 0;
+        
+        for (cpu = 0; cpu < regs_cpus; cpu++) {
+            /* Skip CPUs that have no data */
+            if (capture_cpu_state(cpu, &panel, &snapshot) < 0)
+                continue;
+            
+            /* A snapshot sampled before only goes out again as a heartbeat, so never with -k 0;
+             * state_changed() then also skips new snapshots identical to the last one sent */
+            fresh = snapshot != last_snapshot[cpu];
+            last_snapshot[cpu] = snapshot;
+            if ((!fresh && heartbeat_seconds <= 0) || !state_changed(&changes[cpu], (char *)&panel)) {
+                /* No new snapshot and no heartbeat due; don't hold back what is batched though */
+                if (batch_flush_stale(sockfd, &batches[cpu], 0) < 0) {
+                    perror("send");
+                    break;
+                }
+                continue;
+            } else if (max_count > 1) {
+                /* Queue the sample; the batch goes out once it is full */
+                if (batch_queue(sockfd, &batches[cpu], (char *)&panel, frame_seq[cpu], 0) < 0) {
+                    perror("send");
+                    break;
+                }
+            } else {
+                /* Populate packet structure */
+                stamp_packet_header(&packet.header, frame_seq[cpu]);
+                packet.header.pp_cpu = cpu;
+                packet.panel_state = panel;
+                
+                /* Send panel packet via UDP */
+                if (panel_send(sockfd, (char *)&packet, sizeof(packet), 0) < 0) {
+                    perror("send");
+                    break;
+                }
+            }
+            frame_seq[cpu]++;
+            
+            if (captured++ == 0 && (frame_count + 1) % (FRAMES_PER_SECOND * 2 * max_count) == 0) {  /* Every 2 seconds */
+                printf("Frame %d: CPU%u RIP=0x%lx, RSP=0x%lx, RAX=0x%lx, RBX=0x%lx\n", 
+                       frame_count + 1, cpu, panel.ps_regs.rip, panel.ps_regs.rsp, 
+                       panel.ps_regs.rax, panel.ps_regs.rbx);
+            }
         }
         
-        /* Populate packet structure */
-        packet.header.pp_byte_count = sizeof(struct linuxx64_panel_state);
-        packet.header.pp_byte_flags = PANEL_LINUXX64;
-        packet.panel_state = panel;
+        if (cpu < regs_cpus)
+            break;      /* send failed */
         
-        /* Send panel packet via UDP */
-        if (sendto(sockfd, &packet, sizeof(packet), 0,
-                   (struct sockaddr *)server_addr, sizeof(*server_addr)) < 0) {
-            perror("sendto");
+        /* The packets of all CPUs in this frame go out in as few system calls as -m allows */
+        if (panel_flush(sockfd, 0) < 0) {
+            perror("send");
             break;
         }
         
-        frame_count++;
-        if (frame_count % (FRAMES_PER_SECOND * 2) == 0) {  /* Every 2 seconds */
-            printf("Frame %d: RIP=0x%lx, RSP=0x%lx, RAX=0x%lx, RBX=0x%lx\n", 
-                   frame_count, panel.ps_regs.rip, panel.ps_regs.rsp, 
-                   panel.ps_regs.rax, panel.ps_regs.rbx);
-        }
+        if (captured > 0)
+            frame_count++;
         
-        /* Wait for next frame time */
-        precise_delay(USEC_PER_FRAME);
+        /* Cap the rate; batches sample several times per frame */
+        sleep_until(&deadline, USEC_PER_FRAME / max_count);
     }
+    
+    free(batches);
+    free(frame_seq);
+    free(last_snapshot);
+    free(last_sent);
+    free(changes);
 }
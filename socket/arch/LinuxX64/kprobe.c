@@ -2,69 +2,176 @@
 #include <linux/kernel.h>
 #include <linux/kprobes.h>
 #include <linux/proc_fs.h>
-#include <linux/uaccess.h>
-#include <linux/mutex.h>
+#include <linux/seq_file.h>
+#include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/poll.h>
+#include <linux/irq_work.h>
+#include <linux/mm.h>
+#include <linux/version.h>
+#include "panel_regs.h"
 
-/* Static storage for captured register state */
-static struct pt_regs captured_regs;
-static DEFINE_MUTEX(regs_mutex);
+/* Register snapshot slots, one per possible CPU, mapped read-only by userspace */
+static struct panel_regs_area *regs_area;
 static struct proc_dir_entry *proc_entry;
-static bool regs_valid = false;
+
+/* Readers polling /proc/panel_regs for a new snapshot */
+static DECLARE_WAIT_QUEUE_HEAD(snapshot_wait);
+static struct irq_work snapshot_work;
+
+/* Per open file: the snapshots it was last told about */
+struct panel_regs_reader {
+    u64 generation;
+};
+
+/* Wake up pollers from irq_work, as the probe itself may run with scheduler locks held */
+static void wake_readers(struct irq_work *work)
+{
+    wake_up_interruptible(&snapshot_wait);
+}
 
 static int handler_pre(struct kprobe *p, struct pt_regs *regs)
 {
-    /* Only capture register state on the primary CPU (CPU 0) to avoid 
-     * multiple cores overwriting the same data structure */
-    if (smp_processor_id() != 0)
-        return 0;
-        
-    /* Capture the real register state */
-    mutex_lock(&regs_mutex);
-    captured_regs = *regs;
-    regs_valid = true;
-    mutex_unlock(&regs_mutex);
-    
+    /* Kprobe handlers run with preemption disabled and do not nest on a CPU,
+     * so each slot has a single writer and the sequence count needs no lock;
+     * this runs on every schedule() and must not sleep */
+    struct panel_regs_slot *slot = &regs_area->slot[smp_processor_id()];
+    u32 seq = slot->seq;
+
+    WRITE_ONCE(slot->seq, seq + 1);
+    smp_wmb();
+    memcpy(slot->regs, regs, sizeof(slot->regs));
+    smp_wmb();
+    WRITE_ONCE(slot->seq, seq + 2);
+
+    /* Only wake readers that are waiting; irq_work_queue() is a no-op while a
+     * wakeup is still pending. Without a barrier a poller that just started
+     * waiting may be missed, but the next schedule() call will find it */
+    if (waitqueue_active(&snapshot_wait))
+        irq_work_queue(&snapshot_work);
+
     return 0;
 }
 
-/* Procfs read function to export register data to userspace */
-static ssize_t proc_read(struct file *file, char __user *buffer, size_t count, loff_t *pos)
+/* Sum of all sequence counts, which changes whenever any CPU publishes a snapshot */
+static u64 snapshot_generation(void)
 {
-    int len;
-    char output[512];
-    
-    if (*pos > 0)
-        return 0;
-    
-    mutex_lock(&regs_mutex);
-    if (!regs_valid) {
-        len = snprintf(output, sizeof(output), "No register data captured yet\n");
-    } else {
-        len = snprintf(output, sizeof(output),
-            "RIP=0x%lx RSP=0x%lx RBP=0x%lx RAX=0x%lx RBX=0x%lx RCX=0x%lx RDX=0x%lx "
+    u64 generation = 0;
+    unsigned int cpu;
+
+    for (cpu = 0; cpu < regs_area->cpus; cpu++)
+        generation += READ_ONCE(regs_area->slot[cpu].seq);
+
+    return generation;
+}
+
+/* Copy a consistent snapshot of one CPU; returns false if it captured nothing yet */
+static bool read_snapshot(const struct panel_regs_slot *slot, u64 *regs)
+{
+    u32 seq;
+
+    do {
+        seq = READ_ONCE(slot->seq);
+        smp_rmb();
+        memcpy(regs, slot->regs, sizeof(slot->regs));
+        smp_rmb();
+    } while ((seq & 1) || READ_ONCE(slot->seq) != seq);
+
+    return seq != 0;
+}
+
+/* Text dump of the latest snapshots for diagnostics, one line per CPU */
+static int proc_show(struct seq_file *m, void *v)
+{
+    u64 snapshot[PANEL_REGS_COUNT];
+    struct pt_regs *r = (struct pt_regs *)snapshot;
+    bool captured = false;
+    unsigned int cpu;
+
+    for (cpu = 0; cpu < regs_area->cpus; cpu++) {
+        if (!read_snapshot(&regs_area->slot[cpu], snapshot))
+            continue;
+
+        captured = true;
+        seq_printf(m,
+            "CPU%u RIP=0x%lx RSP=0x%lx RBP=0x%lx RAX=0x%lx RBX=0x%lx RCX=0x%lx RDX=0x%lx "
             "RSI=0x%lx RDI=0x%lx R8=0x%lx R9=0x%lx R10=0x%lx R11=0x%lx R12=0x%lx "
             "R13=0x%lx R14=0x%lx R15=0x%lx EFLAGS=0x%lx CS=0x%lx SS=0x%lx ORIG_RAX=0x%lx\n",
-            captured_regs.ip, captured_regs.sp, captured_regs.bp, captured_regs.ax,
-            captured_regs.bx, captured_regs.cx, captured_regs.dx, captured_regs.si,
-            captured_regs.di, captured_regs.r8, captured_regs.r9, captured_regs.r10,
-            captured_regs.r11, captured_regs.r12, captured_regs.r13, captured_regs.r14,
-            captured_regs.r15, captured_regs.flags, captured_regs.cs, captured_regs.ss,
-            captured_regs.orig_ax);
+            cpu, r->ip, r->sp, r->bp, r->ax, r->bx, r->cx, r->dx, r->si,
+            r->di, r->r8, r->r9, r->r10, r->r11, r->r12, r->r13, r->r14,
+            r->r15, r->flags, (unsigned long)r->cs, (unsigned long)r->ss, r->orig_ax);
     }
-    mutex_unlock(&regs_mutex);
-    
-    if (count < len)
-        return -EINVAL;
-    
-    if (copy_to_user(buffer, output, len))
-        return -EFAULT;
-    
-    *pos = len;
-    return len;
+
+    if (!captured)
+        seq_puts(m, "No register data captured yet\n");
+
+    return 0;
+}
+
+static int proc_open(struct inode *inode, struct file *file)
+{
+    struct panel_regs_reader *reader;
+    int ret;
+
+    reader = kzalloc(sizeof(*reader), GFP_KERNEL);
+    if (!reader)
+        return -ENOMEM;
+
+    ret = single_open(file, proc_show, reader);
+    if (ret)
+        kfree(reader);
+    return ret;
+}
+
+static int proc_release(struct inode *inode, struct file *file)
+{
+    struct seq_file *m = file->private_data;
+
+    kfree(m->private);
+    return single_release(inode, file);
+}
+
+/* Readable once for every change since the last time this file was reported readable,
+ * so a reader that takes its snapshots from the mapping blocks until there is a new one */
+static __poll_t proc_poll(struct file *file, poll_table *wait)
+{
+    struct seq_file *m = file->private_data;
+    struct panel_regs_reader *reader = m->private;
+    u64 generation;
+
+    poll_wait(file, &snapshot_wait, wait);
+
+    generation = snapshot_generation();
+    if (generation == reader->generation)
+        return 0;
+
+    reader->generation = generation;
+    return EPOLLIN | EPOLLRDNORM;
+}
+
+/* Map the snapshot slots into userspace, read-only */
+static int proc_mmap(struct file *file, struct vm_area_struct *vma)
+{
+    if (vma->vm_flags & VM_WRITE)
+        return -EPERM;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+    vm_flags_clear(vma, VM_MAYWRITE);
+#else
+    vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+
+    /* Fails if the mapping is larger than the area */
+    return remap_vmalloc_range(vma, regs_area, vma->vm_pgoff);
 }
 
 static const struct proc_ops proc_fops = {
-    .proc_read = proc_read,
+    .proc_open = proc_open,
+    .proc_read = seq_read,
+    .proc_lseek = seq_lseek,
+    .proc_release = proc_release,
+    .proc_poll = proc_poll,
+    .proc_mmap = proc_mmap,
 };
 
 static struct kprobe kp = {
@@ -75,30 +182,45 @@ static struct kprobe kp = {
 static int __init my_kprobe_init(void)
 {
     int ret;
-    
+
+    BUILD_BUG_ON(sizeof(struct pt_regs) != sizeof(regs_area->slot[0].regs));
+
+    /* Zeroed and suitable for remap_vmalloc_range() */
+    regs_area = vmalloc_user(PANEL_REGS_SIZE(nr_cpu_ids));
+    if (!regs_area)
+        return -ENOMEM;
+    regs_area->magic = PANEL_REGS_MAGIC;
+    regs_area->cpus = nr_cpu_ids;
+    init_irq_work(&snapshot_work, wake_readers);
+
     /* Create procfs entry */
     proc_entry = proc_create("panel_regs", 0444, NULL, &proc_fops);
     if (!proc_entry) {
         printk(KERN_ERR "Failed to create /proc/panel_regs\n");
+        vfree(regs_area);
         return -ENOMEM;
     }
-    
+
     /* Register kprobe */
     ret = register_kprobe(&kp);
     if (ret < 0) {
         printk(KERN_ERR "register_kprobe failed, returned %d\n", ret);
         proc_remove(proc_entry);
+        vfree(regs_area);
         return ret;
     }
-    
-    printk(KERN_INFO "Panel kprobe registered for %s, data available at /proc/panel_regs\n", kp.symbol_name);
+
+    printk(KERN_INFO "Panel kprobe registered for %s on %u CPUs, data available at /proc/panel_regs\n",
+           kp.symbol_name, nr_cpu_ids);
     return 0;
 }
 
 static void __exit my_kprobe_exit(void)
 {
     unregister_kprobe(&kp);
+    irq_work_sync(&snapshot_work);
     proc_remove(proc_entry);
+    vfree(regs_area);
     printk(KERN_INFO "Panel kprobe unregistered\n");
 }
 
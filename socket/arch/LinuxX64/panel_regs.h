@@ -0,0 +1,42 @@
+/*
+ * panel_regs.h - Register snapshot area shared by kprobe.c and client.c
+ *
+ * The kernel module publishes the registers captured in its kprobe into one
+ * slot per CPU, which userspace maps read-only through /proc/panel_regs. Each
+ * slot is only written by its own CPU and is guarded by a sequence count: the
+ * writer makes seq odd, copies the registers and makes seq even again, so a
+ * reader that sees the same even seq before and after copying has a consistent
+ * snapshot. No locks are taken on either side.
+ */
+
+#ifndef LINUXX64_PANEL_REGS_H
+#define LINUXX64_PANEL_REGS_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdint.h>
+#endif
+
+#define PANEL_REGS_PATH     "/proc/panel_regs"
+#define PANEL_REGS_MAGIC    0x326c6e70U     /* "pnl2" */
+#define PANEL_REGS_COUNT    21              /* 64-bit registers in struct pt_regs */
+
+/* Latest snapshot of one CPU, cache line aligned so CPUs never write to the same line */
+struct panel_regs_slot {
+    uint32_t seq;                           /* odd while a snapshot is being written; 0 if none yet */
+    uint32_t reserved;
+    uint64_t regs[PANEL_REGS_COUNT];        /* struct pt_regs of the latest snapshot */
+} __attribute__((aligned(64)));
+
+struct panel_regs_area {
+    uint32_t magic;                         /* PANEL_REGS_MAGIC */
+    uint32_t cpus;                          /* number of slots, indexed by CPU number */
+    struct panel_regs_slot slot[];
+};
+
+/* Bytes to map for an area with the given number of slots */
+#define PANEL_REGS_SIZE(cpus) \
+    (sizeof(struct panel_regs_area) + (cpus) * sizeof(struct panel_regs_slot))
+
+#endif /* LINUXX64_PANEL_REGS_H */
@@ -41,10 +41,12 @@ struct linuxx64_panel_state {
     struct pt_regs ps_regs;        /* panel switches - Linux pt_regs structure */
 };
 
-/* Linux x64 Panel packet structure */
+/* Linux x64 Panel packet structure - packed, the header is not a multiple of 8 bytes */
+#pragma pack(push, 1)
 struct linuxx64_panel_packet {
-    struct panel_packet_header header;
+    struct panel_packet_header_v2 header;
     struct linuxx64_panel_state panel_state;
 };
+#pragma pack(pop)
 
 #endif /* LINUXX64_PANEL_STATE_H */
@@ -9,6 +9,7 @@
 #include <sys/time.h>
 #include <sys/file.h>
 #include <sys/event.h>
+#include <sys/sysctl.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
@@ -21,6 +22,9 @@
 #include <unistd.h>
 #include <stdint.h>
 #include <signal.h>
+#include <kvm.h>
+#include <nlist.h>
+#include <limits.h>
 
 /* External getopt declarations for compatibility */
 extern char *optarg;
@@ -39,16 +43,29 @@ extern int optind, optopt;
 /* Include panel state definitions */
 #include "panel_state.h"
 
-/* Fallback for systems without uintptr_t */
-#ifndef uintptr_t
-#define uintptr_t unsigned long
+/* Define _POSIX2_LINE_MAX if not available */
+#ifndef _POSIX2_LINE_MAX
+#define _POSIX2_LINE_MAX 2048
 #endif
 
+/* Kernel sysctl returning the panel struct, resolved once at startup */
+#define PANEL_STATE_SYSCTL "hw.panel.state"
+static int panel_mib[CTL_MAXNAME];
+static u_int panel_miblen = 0;
+
+/* Fallback for kernels without the sysctl: kvm access to the panel symbol */
+static kvm_t *kd = NULL;
+static struct nlist nl[] = {
+    { "_panel" },
+    { NULL }
+};
+
 /* Function prototypes */
-int open_kmem_and_find_panel(void **panel_addr);
-int read_panel_from_kmem(int kmem_fd, void *panel_addr, struct vax_panel_state *panel);
-void send_frames(int sockfd, struct sockaddr_in *server_addr, int kmem_fd, void *panel_addr);
-void send_frames_with_notification(int sockfd, struct sockaddr_in *server_addr, int kmem_fd, void *panel_addr);
+int open_panel(void);
+int read_panel(struct vax_panel_state *panel);
+void close_panel(void);
+void send_frames(int sockfd);
+void send_frames_with_notification(int sockfd);
 int setup_panel_notification(void);
 void register_with_kernel(void);
 void cleanup_panel_notification(void);
@@ -59,15 +76,28 @@ int main(int argc, char *argv[])
     int sockfd;
     int c;
     struct sockaddr_in server_addr;
-    void *panel_addr;
-    int kmem_fd;
     
     /* Parse command line arguments */
-    while ((c = getopt(argc, argv, "s:h")) != -1) {
+    while ((c = getopt(argc, argv, "s:b:m:k:t:i:h")) != -1) {
         switch (c) {
         case 's':
             server_ip = optarg;
             break;
+        case 'b':
+            batch_samples = atoi(optarg);
+            break;
+        case 'm':
+            send_queue = atoi(optarg);
+            break;
+        case 'k':
+            heartbeat_seconds = atoi(optarg);
+            break;
+        case 't':
+            multicast_ttl = atoi(optarg);
+            break;
+        case 'i':
+            multicast_if = optarg;
+            break;
         case 'h':
         case '?':
             usage(argv[0]);
@@ -86,21 +116,18 @@ int main(int argc, char *argv[])
     /* Register our process with the kernel for panel notifications */
     register_with_kernel();
     
-    /* Open /dev/kmem and find panel symbol */
-    kmem_fd = open_kmem_and_find_panel(&panel_addr);
-    if (kmem_fd < 0) {
-        fprintf(stderr, "Failed to open /dev/kmem or find panel symbol\n");
+    /* Find the panel through sysctl, or in kernel memory */
+    if (open_panel() < 0) {
+        fprintf(stderr, "Failed to find the kernel panel\n");
         cleanup_panel_notification();
         exit(1);
     }
     
-    printf("Panel symbol found at address %p\n", panel_addr);
-    
     /* Create UDP socket and set up server address */
     sockfd = create_udp_socket(server_ip, &server_addr);
     if (sockfd < 0) {
         fprintf(stderr, "Failed to create UDP socket\n");
-        close(kmem_fd);
+        close_panel();
         exit(1);
     }
     
@@ -120,150 +147,88 @@ int main(int argc, char *argv[])
     // Verbose output removed for background operation
     
     /* Send frames continuously with kernel notification */
-    send_frames_with_notification(sockfd, &server_addr, kmem_fd, panel_addr);
+    send_frames_with_notification(sockfd);
     
+    /* Send whatever is still queued */
+    panel_flush(sockfd, 0);
     close(sockfd);
-    close(kmem_fd);
+    close_panel();
     cleanup_panel_notification();
     return 0;
 }
 
-int open_kmem_and_find_panel(void **panel_addr)
+int open_panel(void)
 {
-    FILE *fp;
-    char line[256];
-    char symbol[64];
-    uintptr_t addr;
-    char type;
-    int kmem_fd;
-    int found_panel_symbols = 0;
-    int found_any_symbols = 0;
-    
-    /* First, test if nm works at all */
-    printf("Testing nm command on /netbsd...\n");
-    printf("Kernel info: ");
-    fflush(stdout);
-    system("uname -a");
-    printf("Kernel file: ");
-    fflush(stdout);
-    system("ls -la /netbsd");
-    
-    fp = popen("nm /netbsd | head -5", "r");
-    if (fp == NULL) {
-        fprintf(stderr, "Cannot run nm on /netbsd\n");
-        return -1;
-    }
-    
-    printf("First 5 symbols from nm:\n");
-    while (fgets(line, sizeof(line), fp) && found_any_symbols < 5) {
-        printf("  %s", line);
-        found_any_symbols++;
+    char errbuf[_POSIX2_LINE_MAX];
+    size_t miblen = CTL_MAXNAME;
+    size_t size = 0;
+    
+    /* Prefer the kernel's sysctl, which returns exactly the panel struct */
+    if (sysctlnametomib(PANEL_STATE_SYSCTL, panel_mib, &miblen) == 0 &&
+        sysctl(panel_mib, (u_int)miblen, NULL, &size, NULL, 0) == 0 &&
+        size == sizeof(struct vax_panel_state)) {
+        panel_miblen = (u_int)miblen;
+        printf("Reading panel through sysctl %s\n", PANEL_STATE_SYSCTL);
+        return 0;
     }
-    pclose(fp);
     
-    if (found_any_symbols == 0) {
-        fprintf(stderr, "nm command returned no output - kernel symbol table may not be available\n");
+    /* Otherwise look up the panel symbol in the running kernel and read it from kernel memory */
+    kd = kvm_open(NULL, NULL, NULL, O_RDONLY, errbuf);
+    if (kd == NULL) {
+        fprintf(stderr, "kvm_open: %s\n", errbuf);
         return -1;
     }
     
-    /* Now search specifically for panel */
-    printf("\nSearching for panel symbol...\n");
-    fp = popen("nm /netbsd | grep panel", "r");
-    if (fp == NULL) {
-        fprintf(stderr, "Cannot run nm on /netbsd to find panel symbol\n");
+    if (kvm_nlist(kd, nl) != 0 || nl[0].n_value == 0) {
+        fprintf(stderr, "Panel symbol not found in kernel - the kernel may not have panel support compiled in\n");
+        kvm_close(kd);
+        kd = NULL;
         return -1;
     }
     
-    *panel_addr = NULL;
-    while (fgets(line, sizeof(line), fp)) {
-        found_panel_symbols++;
-        printf("Found panel-related symbol: %s", line);
-        
-        /* Try both octal and hex formats */
-        if (sscanf(line, "%lo %c %s", &addr, &type, symbol) == 3 ||
-            sscanf(line, "%lx %c %s", &addr, &type, symbol) == 3) {
-            printf("  -> Parsed: addr=0x%lx, type='%c', symbol='%s'\n", 
-                   (unsigned long)addr, type, symbol);
-            
-            if (strcmp(symbol, "panel") == 0 || strcmp(symbol, "_panel") == 0) {
-                printf("  -> MATCH! Using symbol '%s' at address 0x%lx\n", 
-                       symbol, (unsigned long)addr);
-                *panel_addr = (void*)addr;
-                break;
-            }
-        } else {
-            printf("  -> Failed to parse line\n");
-        }
-    }
-    pclose(fp);
-    
-    printf("Total panel-related symbols found: %d\n", found_panel_symbols);
-    
-    if (*panel_addr == NULL) {
-        if (found_panel_symbols == 0) {
-            fprintf(stderr, "No panel symbols found in kernel - the kernel may not have panel support compiled in\n");
-            fprintf(stderr, "Try checking: nm /netbsd | grep panel\n");
-        } else {
-            fprintf(stderr, "Panel symbol not found in kernel symbol table\n");
-            fprintf(stderr, "Looking specifically for symbol named 'panel' or '_panel'\n");
-        }
-        return -1;
-    }
+    printf("Panel symbol found at address 0x%lx\n", (unsigned long)nl[0].n_value);
+    return 0;
+}
+
+int read_panel(struct vax_panel_state *panel)
+{
+    size_t size = sizeof(*panel);
     
-    /* Open /dev/kmem */
-    kmem_fd = open("/dev/kmem", O_RDONLY);
-    if (kmem_fd < 0) {
-        perror("open /dev/kmem");
-        /* On NetBSD, try /dev/mem as fallback */
-        kmem_fd = open("/dev/mem", O_RDONLY);
-        if (kmem_fd < 0) {
-            perror("open /dev/mem");
+    if (panel_miblen > 0) {
+        if (sysctl(panel_mib, panel_miblen, panel, &size, NULL, 0) < 0) {
+            perror("sysctl " PANEL_STATE_SYSCTL);
             return -1;
         }
-        printf("Using /dev/mem instead of /dev/kmem\n");
+        return 0;
     }
     
-    return kmem_fd;
+    /* A single read of exactly the panel struct */
+    if (kvm_read(kd, nl[0].n_value, panel, size) != (ssize_t)size) {
+        fprintf(stderr, "kvm_read: %s\n", kvm_geterr(kd));
+        return -1;
+    }
+    return 0;
 }
 
-int read_panel_from_kmem(int kmem_fd, void *panel_addr, struct vax_panel_state *panel)
+void close_panel(void)
 {
-    off_t offset = (off_t)(uintptr_t)panel_addr;
-    unsigned char raw_data[128];  /* Buffer for raw kernel panel data */
-    size_t bytes_to_read = sizeof(raw_data);
-    struct timeval tv;
-    
-    /* Seek to panel address in kernel memory */
-    if (lseek(kmem_fd, offset, SEEK_SET) < 0) {
-        perror("lseek");
-        return -1;
+    if (kd != NULL) {
+        kvm_close(kd);
+        kd = NULL;
     }
-    
-    /* Read raw panel data from kernel */
-    if (read(kmem_fd, raw_data, bytes_to_read) < 0) {
-        perror("read");
-        return -1;
-    }
-
-    
-    /* Get current time for dynamic data */
-    gettimeofday(&tv, NULL);
-    
-    /* Convert raw kernel data to VAX panel format */
-    /* Since we're on the same architecture, we can directly extract values */
-    
-    /* Extract address and data directly from raw memory */
-    panel->ps_address = *(uint32_t*)&raw_data[0];
-    panel->ps_data = *(uint32_t*)&raw_data[4];
-    
-    return 0;
+    panel_miblen = 0;
 }
 
-void send_frames_with_notification(int sockfd, struct sockaddr_in *server_addr, int kmem_fd, void *panel_addr)
+void send_frames_with_notification(int sockfd)
 {
     struct vax_panel_state panel;
     struct vax_panel_packet packet;
+    struct panel_batch batch;
     int frame_count = 0;
+    struct vax_panel_state last_sent;
+    struct panel_change change;
+    unsigned long seq = 0;
+    int send_result;
     struct timeval start_time, current_time;
     double elapsed_seconds, actual_fps;
     
@@ -273,6 +238,10 @@ void send_frames_with_notification(int sockfd, struct sockaddr_in *server_addr,
     printf("Starting PURE EVENT-DRIVEN panel monitoring (no polling)...\n");
     printf("Waiting for kernel signals at system interrupt rate (typically 100 Hz on NetBSD VAX)...\n");
     
+    init_packet_header(&packet.header, sizeof(struct vax_panel_state), PANEL_VAX);
+    batch_init(&batch, sizeof(struct vax_panel_state), PANEL_VAX);
+    change_init(&change, (char *)&last_sent, sizeof(last_sent));
+    
     while (1) {
         /* PURE EVENT-DRIVEN: Only wait for kernel notification, no fallback */
         if (wait_for_panel_notification() <= 0) {
@@ -283,21 +252,31 @@ void send_frames_with_notification(int sockfd, struct sockaddr_in *server_addr,
         
         /* Kernel signaled us - send frame immediately */
         
-        /* Read panel structure from kernel memory */
-        if (read_panel_from_kmem(kmem_fd, panel_addr, &panel) < 0) {
+        /* Read panel structure from the kernel */
+        if (read_panel(&panel) < 0) {
             fprintf(stderr, "Failed to read panel data from kernel\n");
             break;
         }
         
-        /* Populate packet structure */
-        packet.header.pp_byte_count = sizeof(struct vax_panel_state);
-        packet.header.pp_byte_flags = PANEL_VAX;  /* Set panel type flag */
-        packet.panel_state = panel;
-        
-        /* Send panel packet via UDP with immediate transmission */
-        if (sendto(sockfd, &packet, sizeof(packet), MSG_DONTWAIT,
-                   (struct sockaddr *)server_addr, sizeof(*server_addr)) < 0) {
-            fprintf(stderr, "sendto failed after %d packets: ", frame_count);
+        if (!state_changed(&change, (char *)&panel)) {
+            /* Unchanged, so nothing to send; don't hold back what is batched though */
+            send_result = batch_flush_stale(sockfd, &batch, MSG_DONTWAIT);
+        } else if (batch.max_count > 1) {
+            /* Queue the sample; the batch goes out once it is full */
+            send_result = batch_queue(sockfd, &batch, (char *)&panel, seq++, MSG_DONTWAIT);
+        } else {
+            /* Populate packet structure */
+            stamp_packet_header(&packet.header, seq++);
+            packet.panel_state = panel;
+            
+            /* Send panel packet via UDP with immediate transmission */
+            send_result = panel_send(sockfd, (char *)&packet, sizeof(packet), MSG_DONTWAIT);
+        }
+        /* Don't hold back packets queued for sendmmsg() either */
+        if (send_result >= 0)
+            send_result = panel_flush_stale(sockfd, MSG_DONTWAIT);
+        if (send_result < 0) {
+            fprintf(stderr, "send failed after %d packets: ", frame_count);
             perror("");
             if (errno == ENETUNREACH) {
                 fprintf(stderr, "Network unreachable - check server IP address\n");
@@ -323,33 +302,52 @@ void send_frames_with_notification(int sockfd, struct sockaddr_in *server_addr,
     }
 }
 
-void send_frames(int sockfd, struct sockaddr_in *server_addr, int kmem_fd, void *panel_addr)
+void send_frames(int sockfd)
 {
     struct vax_panel_state panel;
     struct vax_panel_packet packet;
+    struct panel_batch batch;
     int frame_count = 0;
+    struct vax_panel_state last_sent;
+    struct panel_change change;
+    unsigned long seq = 0;
+    int send_result;
     struct timeval start_time, current_time;
     double elapsed_seconds, actual_fps;
     
     /* Get start time for FPS measurement */
     gettimeofday(&start_time, NULL);
     
+    init_packet_header(&packet.header, sizeof(struct vax_panel_state), PANEL_VAX);
+    batch_init(&batch, sizeof(struct vax_panel_state), PANEL_VAX);
+    change_init(&change, (char *)&last_sent, sizeof(last_sent));
+    
     while (1) {
-        /* Read panel structure from kernel memory */
-        if (read_panel_from_kmem(kmem_fd, panel_addr, &panel) < 0) {
+        /* Read panel structure from the kernel */
+        if (read_panel(&panel) < 0) {
             fprintf(stderr, "Failed to read panel data from kernel\n");
             break;
         }
         
-        /* Populate packet structure */
-        packet.header.pp_byte_count = sizeof(struct vax_panel_state);
-        packet.header.pp_byte_flags = PANEL_VAX;  /* Set panel type flag */
-        packet.panel_state = panel;
-        
-        /* Send panel packet via UDP with immediate transmission */
-        if (sendto(sockfd, &packet, sizeof(packet), MSG_DONTWAIT,
-                   (struct sockaddr *)server_addr, sizeof(*server_addr)) < 0) {
-            fprintf(stderr, "sendto failed after %d packets: ", frame_count);
+        if (!state_changed(&change, (char *)&panel)) {
+            /* Unchanged, so nothing to send; don't hold back what is batched though */
+            send_result = batch_flush_stale(sockfd, &batch, MSG_DONTWAIT);
+        } else if (batch.max_count > 1) {
+            /* Queue the sample; the batch goes out once it is full */
+            send_result = batch_queue(sockfd, &batch, (char *)&panel, seq++, MSG_DONTWAIT);
+        } else {
+            /* Populate packet structure */
+            stamp_packet_header(&packet.header, seq++);
+            packet.panel_state = panel;
+            
+            /* Send panel packet via UDP with immediate transmission */
+            send_result = panel_send(sockfd, (char *)&packet, sizeof(packet), MSG_DONTWAIT);
+        }
+        /* Don't hold back packets queued for sendmmsg() either */
+        if (send_result >= 0)
+            send_result = panel_flush_stale(sockfd, MSG_DONTWAIT);
+        if (send_result < 0) {
+            fprintf(stderr, "send failed after %d packets: ", frame_count);
             perror("");
             if (errno == ENETUNREACH) {
                 fprintf(stderr, "Network unreachable - check server IP address\n");
@@ -372,12 +370,12 @@ void send_frames(int sockfd, struct sockaddr_in *server_addr, int kmem_fd, void
         
         /* First packet success notification removed for background operation */
         
-        /* Wait for next frame time */
+        /* Wait for next sample time; batches sample several times per frame */
         /* Testing different timing methods to resolve 2x timing issue on NetBSD VAX */
 #ifdef USE_USLEEP
-        usleep(USEC_PER_FRAME);
+        usleep(USEC_PER_FRAME / batch.max_count);
 #else
-        precise_delay(USEC_PER_FRAME);
+        precise_delay(USEC_PER_FRAME / batch.max_count);
 #endif
     }
 }
@@ -418,15 +416,13 @@ int setup_panel_notification(void)
 void register_with_kernel(void)
 {
     /* Register our PID with the kernel so it knows to send us notifications */
-    pid_t our_pid = getpid();
-    char sysctl_cmd[256];
+    int our_pid = (int)getpid();
+    int enabled = 1;
     
     printf("Panel client PID %d registering for kernel notifications\n", our_pid);
     
     /* Use sysctl to register our PID with the kernel */
-    snprintf(sysctl_cmd, sizeof(sysctl_cmd), "sysctl -w hw.panel.client_pid=%d", our_pid);
-    int result = system(sysctl_cmd);
-    if (result == 0) {
+    if (sysctlbyname("hw.panel.client_pid", NULL, NULL, &our_pid, sizeof(our_pid)) == 0) {
         printf("Successfully registered with kernel notification system\n");
     } else {
         printf("Warning: Could not register with kernel (sysctl failed)\n");
@@ -434,8 +430,7 @@ void register_with_kernel(void)
     }
     
     /* Also enable panel notifications */
-    result = system("sysctl -w hw.panel.enabled=1");
-    if (result != 0) {
+    if (sysctlbyname("hw.panel.enabled", NULL, NULL, &enabled, sizeof(enabled)) < 0) {
         printf("Warning: Could not enable panel notifications\n");
     }
 }
@@ -168,6 +168,7 @@ static void panel_notify_userspace(void);
 static void panel_update_tick(void);
 static int sysctl_panel_notification_enabled(SYSCTLFN_PROTO);
 static int sysctl_panel_client_pid(SYSCTLFN_PROTO);
+static int sysctl_panel_state(SYSCTLFN_PROTO);
 void panel_notification_init(void);  /* Non-static - called from initclocks */
 
 static void
@@ -634,6 +635,27 @@ sysctl_panel_client_pid(SYSCTLFN_ARGS)
 	return 0;
 }
 
+/*
+ * Sysctl handler returning the cached clockframe, so the panel client
+ * can read exactly the panel struct without going through /dev/kmem
+ */
+static int
+sysctl_panel_state(SYSCTLFN_ARGS)
+{
+	struct sysctlnode node = *rnode;
+	struct panel_state state;
+	int s;
+
+	/* hardclock() updates the panel, so copy it with clock interrupts blocked */
+	s = splclock();
+	state = panel;
+	splx(s);
+
+	node.sysctl_data = &state;
+	node.sysctl_size = sizeof(state);
+	return sysctl_lookup(SYSCTLFN_CALL(&node));
+}
+
 /*
  * Send panel update notification to userspace via signal
  */
@@ -709,6 +731,14 @@ panel_notification_init(void)
 		              sysctl_panel_client_pid, 0,
 		              &panel_client_pid, 0,
 		              CTL_HW, node->sysctl_num, CTL_CREATE, CTL_EOL);
+
+		sysctl_createv(NULL, 0, NULL, NULL,
+		              CTLFLAG_PERMANENT | CTLFLAG_READONLY,
+		              CTLTYPE_STRUCT, "state",
+		              SYSCTL_DESCR("Clockframe of the last primary CPU interrupt"),
+		              sysctl_panel_state, 0,
+		              NULL, sizeof(struct panel_state),
+		              CTL_HW, node->sysctl_num, CTL_CREATE, CTL_EOL);
 	}
 
 	printf("Panel notification system initialized\n");
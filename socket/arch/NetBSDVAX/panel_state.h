@@ -21,7 +21,7 @@ struct vax_panel_state {
 
 /* VAX Panel packet structure */
 struct vax_panel_packet {
-    struct panel_packet_header header;
+    struct panel_packet_header_v2 header;
     struct vax_panel_state panel_state;
 };
 
@@ -45,7 +45,7 @@ static struct nlist nl[] = {
 /* Function prototypes */
 int open_kvm_and_find_panel(void);
 int read_panel_from_kvm(struct netbsdx64_panel_state *panel);
-void send_frames(int sockfd, struct sockaddr_in *server_addr);
+void send_frames(int sockfd);
 
 int main(int argc, char *argv[])
 {
@@ -55,11 +55,26 @@ int main(int argc, char *argv[])
     struct sockaddr_in server_addr;
     
     /* Parse command line arguments */
-    while ((c = getopt(argc, argv, "s:h")) != -1) {
+    while ((c = getopt(argc, argv, "s:b:m:k:t:i:h")) != -1) {
         switch (c) {
         case 's':
             server_ip = optarg;
             break;
+        case 'b':
+            batch_samples = atoi(optarg);
+            break;
+        case 'm':
+            send_queue = atoi(optarg);
+            break;
+        case 'k':
+            heartbeat_seconds = atoi(optarg);
+            break;
+        case 't':
+            multicast_ttl = atoi(optarg);
+            break;
+        case 'i':
+            multicast_if = optarg;
+            break;
         case 'h':
         case '?':
             usage(argv[0]);
@@ -91,8 +106,10 @@ int main(int argc, char *argv[])
     printf("Packet size: %d bytes\n", (int)sizeof(struct netbsdx64_panel_packet));
     
     /* Send frames continuously */
-    send_frames(sockfd, &server_addr);
+    send_frames(sockfd);
     
+    /* Send whatever is still queued */
+    panel_flush(sockfd, 0);
     close(sockfd);
     if (kd) kvm_close(kd);
     return 0;
@@ -156,11 +173,19 @@ int read_panel_from_kvm(struct netbsdx64_panel_state *panel)
     return 0;
 }
 
-void send_frames(int sockfd, struct sockaddr_in *server_addr)
+void send_frames(int sockfd)
 {
     struct netbsdx64_panel_state panel;
     struct netbsdx64_panel_packet packet;
+    struct panel_batch batch;
     int frame_count = 0;
+    struct netbsdx64_panel_state last_sent;
+    struct panel_change change;
+    unsigned long seq = 0;
+    
+    init_packet_header(&packet.header, sizeof(struct netbsdx64_panel_state), PANEL_NETBSDX64);
+    batch_init(&batch, sizeof(struct netbsdx64_panel_state), PANEL_NETBSDX64);
+    change_init(&change, (char *)&last_sent, sizeof(last_sent));
     
     while (1) {
         /* Read panel structure from kernel memory */
@@ -169,20 +194,38 @@ void send_frames(int sockfd, struct sockaddr_in *server_addr)
             break;
         }
         
-        /* Populate packet structure */
-        packet.header.pp_byte_count = sizeof(struct netbsdx64_panel_state);
-        packet.header.pp_byte_flags = PANEL_NETBSDX64;  /* Set panel type flag */
-        packet.panel_state = panel;
+        if (!state_changed(&change, (char *)&panel)) {
+            /* Unchanged, so nothing to send; don't hold back what is batched though */
+            if (batch_flush_stale(sockfd, &batch, 0) < 0) {
+                perror("send");
+                break;
+            }
+        } else if (batch.max_count > 1) {
+            /* Queue the sample; the batch goes out once it is full */
+            if (batch_queue(sockfd, &batch, (char *)&panel, seq++, 0) < 0) {
+                perror("send");
+                break;
+            }
+        } else {
+            /* Populate packet structure */
+            stamp_packet_header(&packet.header, seq++);
+            packet.panel_state = panel;
+            
+            /* Send panel packet via UDP */
+            if (panel_send(sockfd, (char *)&packet, sizeof(packet), 0) < 0) {
+                perror("send");
+                break;
+            }
+        }
         
-        /* Send panel packet via UDP */
-        if (sendto(sockfd, &packet, sizeof(packet), 0,
-                   (struct sockaddr *)server_addr, sizeof(*server_addr)) < 0) {
-            perror("sendto");
+        /* Don't hold back packets queued for sendmmsg() either */
+        if (panel_flush_stale(sockfd, 0) < 0) {
+            perror("send");
             break;
         }
         
         frame_count++;
-        if (frame_count % (FRAMES_PER_SECOND * 1) == 0) {  /* Every 1 second */
+        if (frame_count % (FRAMES_PER_SECOND * batch.max_count) == 0) {  /* Every 1 second */
             printf("Sent %d panel updates (cf_rip=0x%lx, cf_rsp=0x%lx)\n", 
                    frame_count, (unsigned long)panel.ps_frame.cf_rip, (unsigned long)panel.ps_frame.cf_rsp);
         }
@@ -196,7 +239,7 @@ void send_frames(int sockfd, struct sockaddr_in *server_addr)
             }
         }
         
-        /* Wait for next frame time */
-        precise_delay(USEC_PER_FRAME);
+        /* Wait for next sample time; batches sample several times per frame */
+        precise_delay(USEC_PER_FRAME / batch.max_count);
     }
 }
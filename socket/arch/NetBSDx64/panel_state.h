@@ -49,7 +49,7 @@ struct netbsdx64_panel_state {
 
 /* NetBSD x64 Panel packet structure */
 struct netbsdx64_panel_packet {
-    struct panel_packet_header header;
+    struct panel_packet_header_v2 header;
     struct netbsdx64_panel_state panel_state;
 };
 
@@ -40,7 +40,7 @@
 /* Function prototypes */
 int capture_cpu_state(struct macos_panel_state *panel);
 int get_system_stats(struct macos_panel_state *panel);
-void send_frames(int sockfd, struct sockaddr_in *server_addr);
+void send_frames(int sockfd);
 
 int main(int argc, char *argv[])
 {
@@ -50,11 +50,26 @@ int main(int argc, char *argv[])
     struct sockaddr_in server_addr;
     
     /* Parse command line arguments */
-    while ((c = getopt(argc, argv, "s:h")) != -1) {
+    while ((c = getopt(argc, argv, "s:b:m:k:t:i:h")) != -1) {
         switch (c) {
         case 's':
             server_ip = optarg;
             break;
+        case 'b':
+            batch_samples = atoi(optarg);
+            break;
+        case 'm':
+            send_queue = atoi(optarg);
+            break;
+        case 'k':
+            heartbeat_seconds = atoi(optarg);
+            break;
+        case 't':
+            multicast_ttl = atoi(optarg);
+            break;
+        case 'i':
+            multicast_if = optarg;
+            break;
         case 'h':
         case '?':
             usage(argv[0]);
@@ -74,8 +89,10 @@ int main(int argc, char *argv[])
     printf("Packet size: %d bytes\n", (int)sizeof(struct macos_panel_packet));
     
     /* Send panel data frames */
-    send_frames(sockfd, &server_addr);
+    send_frames(sockfd);
     
+    /* Send whatever is still queued */
+    panel_flush(sockfd, 0);
     close(sockfd);
     return 0;
 }
@@ -210,11 +227,19 @@ int get_system_stats(struct macos_panel_state *panel)
     return 0;
 }
 
-void send_frames(int sockfd, struct sockaddr_in *server_addr)
+void send_frames(int sockfd)
 {
     struct macos_panel_state panel;
     struct macos_panel_packet packet;
+    struct panel_batch batch;
     int frame_count = 0;
+    struct macos_panel_state last_sent;
+    struct panel_change change;
+    unsigned long seq = 0;
+    
+    init_packet_header(&packet.header, sizeof(struct macos_panel_state), PANEL_MACOS);
+    batch_init(&batch, sizeof(struct macos_panel_state), PANEL_MACOS);
+    change_init(&change, (char *)&last_sent, sizeof(last_sent));
     
     while (1) {
         /* Capture current CPU state and system stats */
@@ -227,20 +252,38 @@ void send_frames(int sockfd, struct sockaddr_in *server_addr)
             fprintf(stderr, "Failed to get system stats\n");
         }
         
-        /* Populate packet structure */
-        packet.header.pp_byte_count = sizeof(struct macos_panel_state);
-        packet.header.pp_byte_flags = PANEL_MACOS;
-        packet.panel_state = panel;
+        if (!state_changed(&change, (char *)&panel)) {
+            /* Unchanged, so nothing to send; don't hold back what is batched though */
+            if (batch_flush_stale(sockfd, &batch, 0) < 0) {
+                perror("send");
+                break;
+            }
+        } else if (batch.max_count > 1) {
+            /* Queue the sample; the batch goes out once it is full */
+            if (batch_queue(sockfd, &batch, (char *)&panel, seq++, 0) < 0) {
+                perror("send");
+                break;
+            }
+        } else {
+            /* Populate packet structure */
+            stamp_packet_header(&packet.header, seq++);
+            packet.panel_state = panel;
+            
+            /* Send panel packet via UDP */
+            if (panel_send(sockfd, (char *)&packet, sizeof(packet), 0) < 0) {
+                perror("send");
+                break;
+            }
+        }
         
-        /* Send panel packet via UDP */
-        if (sendto(sockfd, &packet, sizeof(packet), 0,
-                   (struct sockaddr *)server_addr, sizeof(*server_addr)) < 0) {
-            perror("sendto");
+        /* Don't hold back packets queued for sendmmsg() either */
+        if (panel_flush_stale(sockfd, 0) < 0) {
+            perror("send");
             break;
         }
         
         frame_count++;
-        if (frame_count % (FRAMES_PER_SECOND * 2) == 0) {  /* Every 2 seconds */
+        if (frame_count % (FRAMES_PER_SECOND * 2 * batch.max_count) == 0) {  /* Every 2 seconds */
             printf("Frame %d: PC=0x%llx, SP=0x%llx, X0=0x%llx, X1=0x%llx\n", 
                    frame_count, panel.pc, panel.sp, panel.x0, panel.x1);
             printf("  CPU: %d%%, MEM: %d%%, LOAD: %.2f, THREADS: %d\n", 
@@ -255,7 +298,7 @@ void send_frames(int sockfd, struct sockaddr_in *server_addr)
                    panel.pc, panel.x0, panel.x1, panel.timestamp);
         }
         
-        /* Wait for next frame time */
-        precise_delay(USEC_PER_FRAME);
+        /* Wait for next sample time; batches sample several times per frame */
+        precise_delay(USEC_PER_FRAME / batch.max_count);
     }
 }
@@ -32,10 +32,12 @@ struct macos_panel_state {
     uint32_t timestamp;    /* Timestamp of snapshot */
 };
 
-/* macOS Panel packet structure */
+/* macOS Panel packet structure - packed, the header is not a multiple of 8 bytes */
+#pragma pack(push, 1)
 struct macos_panel_packet {
-    struct panel_packet_header header;
+    struct panel_packet_header_v2 header;
     struct macos_panel_state panel_state;
 };
+#pragma pack(pop)
 
 #endif /* MACOS_PANEL_STATE_H */
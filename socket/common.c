@@ -19,13 +19,33 @@
 /* Add close() declaration for older systems */
 #ifdef __pdp11__
 extern int close();
+extern long gethostid();
 #else
 #include <unistd.h>  /* For close() */
+#include <time.h>    /* For clock_gettime() */
+#include <sys/uio.h> /* For struct iovec */
 #endif
 
+#include "panel_packet.h"
+
 /* Common definitions */
 #define FRAMES_PER_SECOND 60
 #define USEC_PER_FRAME (1000000 / FRAMES_PER_SECOND)
+#define PANEL_BATCH_BYTES 1400  /* Batch payload limit, well within an Ethernet MTU */
+
+/*
+ * sendmmsg() came with MSG_WAITFORONE (Linux 3.0, NetBSD 7). glibc only
+ * declares it with _GNU_SOURCE; 211BSD and macOS do not have it at all.
+ */
+#if defined(MSG_WAITFORONE) && (defined(_GNU_SOURCE) || !defined(__GLIBC__))
+#define HAVE_SENDMMSG
+#define SEND_QUEUE_MAX 16       /* Packets per sendmmsg() */
+#endif
+
+int send_queue = 1;             /* Packets per system call, set with -m */
+int heartbeat_seconds = 1;      /* Resend an unchanged state this often, set with -k */
+int multicast_ttl = 1;          /* Hops a multicast packet may take, set with -t */
+char *multicast_if = NULL;      /* Address of the interface to send multicast on, set with -i */
 
 /* Panel type enumeration for packet flags */
 typedef enum {
@@ -36,10 +56,21 @@ typedef enum {
     PANEL_LINUXX64 = 5      /* Linux x64 panel */
 } panel_type_t;
 
+/*
+ * 32-bit header fields are little-endian on the wire. PDP-11 longs are stored
+ * high word first, so their halves are swapped before they are sent.
+ */
+#ifdef __pdp11__
+#define WIRE_LONG(x) ((((unsigned long)(x) & 0xffffL) << 16) | (((unsigned long)(x) >> 16) & 0xffffL))
+#else
+#define WIRE_LONG(x) ((uint32_t)(x))
+#endif
+
 /* Function implementations */
 int create_udp_socket(char *server_ip, struct sockaddr_in *server_addr)
 {
     int sockfd;
+    int on;
     struct hostent *host;
     
     /* Create UDP socket */
@@ -67,13 +98,70 @@ int create_udp_socket(char *server_ip, struct sockaddr_in *server_addr)
         memcpy(&server_addr->sin_addr, host->h_addr, host->h_length);
     }
     
+    /* Allow a broadcast address as the destination */
+    on = 1;
+    if (setsockopt(sockfd, SOL_SOCKET, SO_BROADCAST, (char *)&on, sizeof(on)) < 0)
+        perror("setsockopt SO_BROADCAST");
+    
+#ifdef IP_MULTICAST_TTL
+    /*
+     * With a multicast group as the destination, any number of proxies can
+     * subscribe to the same packets; the client still sends each one once
+     */
+    if (IN_MULTICAST(ntohl(server_addr->sin_addr.s_addr))) {
+        unsigned char ttl = (unsigned char)multicast_ttl;
+        struct in_addr interface;
+        
+        if (setsockopt(sockfd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0)
+            perror("setsockopt IP_MULTICAST_TTL");
+        
+        if (multicast_if != NULL) {
+            interface.s_addr = inet_addr(multicast_if);
+            if (interface.s_addr == INADDR_NONE) {
+                fprintf(stderr, "Invalid interface address: %s\n", multicast_if);
+                close(sockfd);
+                return -1;
+            }
+            if (setsockopt(sockfd, IPPROTO_IP, IP_MULTICAST_IF, &interface, sizeof(interface)) < 0) {
+                perror("setsockopt IP_MULTICAST_IF");
+                close(sockfd);
+                return -1;
+            }
+        }
+    }
+#endif
+    
+    /*
+     * Connect the socket, so packets can go out with send() and the kernel
+     * does not have to look up the destination for every one of them
+     */
+    if (connect(sockfd, (struct sockaddr *)server_addr, sizeof(*server_addr)) < 0) {
+        perror("connect");
+        close(sockfd);
+        return -1;
+    }
+    
+#ifdef HAVE_SENDMMSG
+    if (send_queue > SEND_QUEUE_MAX)
+        send_queue = SEND_QUEUE_MAX;
+#else
+    if (send_queue > 1)
+        fprintf(stderr, "No sendmmsg() on this system, sending one packet per system call\n");
+    send_queue = 1;
+#endif
+    
     return sockfd;
 }
 
 void usage(char *progname)
 {
-    printf("Usage: %s [-s server_ip]\n", progname);
-    printf("  -s server_ip   IP address of server (default: 127.0.0.1)\n");
+    printf("Usage: %s [-s server_ip] [-b samples] [-m packets] [-k seconds] [-t ttl] [-i interface]\n", progname);
+    printf("  -s server_ip   IP address of server, or a multicast group or broadcast address (default: 127.0.0.1)\n");
+    printf("  -b samples     Send this many samples per packet (default: 1)\n");
+    printf("  -m packets     Send up to this many packets per system call (default: 1)\n");
+    printf("  -k seconds     Resend an unchanged state this often; 0 sends every sample (default: 1)\n");
+    printf("  -t ttl         Hops multicast packets may take (default: 1)\n");
+    printf("  -i interface   Address of the interface to send multicast packets on\n");
     printf("  -h             Show this help\n");
 }
 
@@ -88,3 +176,319 @@ void precise_delay(long usec)
     /* Use select() with no file descriptors as a portable delay */
     select(0, NULL, NULL, NULL, &timeout);
 }
+
+/*
+ * Sender clock for the version 2 header, in microseconds. Only differences
+ * between timestamps matter, so it may start anywhere and wraps at 2^32.
+ */
+unsigned long panel_timestamp_usec()
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+#else
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (unsigned long)tv.tv_sec * 1000000UL + tv.tv_usec;
+#endif
+}
+
+/* Fill in the parts of a version 2 header that stay the same for every packet */
+void init_packet_header(struct panel_packet_header_v2 *header, int byte_count, long panel_type)
+{
+    header->pp_byte_count = byte_count;
+    header->pp_byte_flags = WIRE_LONG(panel_type | PP_VERSION_2);
+    header->pp_seq = 0;
+    header->pp_timestamp = 0;
+    header->pp_host_id = WIRE_LONG(gethostid());
+    header->pp_cpu = 0;
+}
+
+/* Set the sequence number and send time of the next packet */
+void stamp_packet_header(struct panel_packet_header_v2 *header, unsigned long seq)
+{
+    header->pp_seq = WIRE_LONG(seq);
+    header->pp_timestamp = WIRE_LONG(panel_timestamp_usec());
+}
+
+/*
+ * Sending on the connected socket. With send_queue > 1 packets are queued and
+ * handed to the kernel send_queue at a time with one sendmmsg() call, which
+ * saves system calls at the cost of holding packets back until the queue is
+ * full, panel_flush() is called or panel_flush_stale() finds them a frame
+ * old. Without sendmmsg() every packet is sent right away.
+ */
+#ifdef HAVE_SENDMMSG
+struct send_slot {
+    char data[sizeof(struct panel_packet_header_v2) + PANEL_BATCH_BYTES];
+    struct iovec iov;
+};
+
+static struct send_slot send_slots[SEND_QUEUE_MAX];
+static struct mmsghdr send_msgs[SEND_QUEUE_MAX];
+static int send_count = 0;      /* Packets queued */
+static unsigned long send_first_time;   /* Sender time the oldest queued packet was queued */
+#endif
+
+/*
+ * A connected socket reports an ICMP port unreachable for an earlier packet
+ * as ECONNREFUSED on the next send. The proxy may just not be running yet,
+ * which is no reason to stop sending.
+ */
+int ignore_refused(int result)
+{
+    if (result < 0 && errno == ECONNREFUSED)
+        return 0;
+    return result;
+}
+
+/* Send the queued packets; returns the number sent, or -1 and errno on failure */
+int panel_flush(int sockfd, int flags)
+{
+#ifdef HAVE_SENDMMSG
+    int sent = 0;
+    int result;
+
+    while (sent < send_count) {
+        result = sendmmsg(sockfd, send_msgs + sent, send_count - sent, flags);
+        if (result < 0) {
+            if (errno == ECONNREFUSED)
+                continue;   /* The error was consumed, try again */
+
+            /* Drop what could not be sent, like a single send would */
+            send_count = 0;
+            return -1;
+        }
+        sent += result;
+    }
+
+    send_count = 0;
+    return sent;
+#else
+    (void)sockfd;
+    (void)flags;
+    return 0;
+#endif
+}
+
+/* Send one packet, or queue it if send_queue > 1; returns -1 and errno on failure */
+int panel_send(int sockfd, char *packet, int length, int flags)
+{
+#ifdef HAVE_SENDMMSG
+    struct send_slot *slot;
+
+    if (send_queue > 1) {
+        if (send_count == 0)
+            send_first_time = panel_timestamp_usec();
+        slot = &send_slots[send_count];
+        memcpy(slot->data, packet, length);
+        slot->iov.iov_base = slot->data;
+        slot->iov.iov_len = length;
+        memset(&send_msgs[send_count], 0, sizeof(send_msgs[send_count]));
+        send_msgs[send_count].msg_hdr.msg_iov = &slot->iov;
+        send_msgs[send_count].msg_hdr.msg_iovlen = 1;
+
+        if (++send_count >= send_queue)
+            return panel_flush(sockfd, flags) < 0 ? -1 : length;
+        return length;
+    }
+#endif
+
+    return ignore_refused(send(sockfd, packet, length, flags));
+}
+
+/*
+ * Send the queued packets once the oldest is a frame old, so that a queue
+ * that fills slowly, as while the state is unchanged, does not hold packets
+ * back. Clients call it once per loop iteration. Returns the panel_flush()
+ * result, or 0 if nothing was sent.
+ */
+int panel_flush_stale(int sockfd, int flags)
+{
+#ifdef HAVE_SENDMMSG
+    if (send_count == 0 ||
+        ((panel_timestamp_usec() - send_first_time) & 0xffffffffUL) < USEC_PER_FRAME)
+        return 0;
+
+    return panel_flush(sockfd, flags);
+#else
+    (void)sockfd;
+    (void)flags;
+    return 0;
+#endif
+}
+
+/*
+ * Batched sending (PP_BATCH): up to batch_samples consecutive samples go out
+ * in one packet, each prefixed with its time offset from the first. This cuts
+ * the per-packet cost on both ends when sampling at high rates.
+ */
+
+struct panel_batch {
+    struct panel_packet_header_v2 header;
+    unsigned char payload[PANEL_BATCH_BYTES];
+    int state_size;             /* Bytes per panel_state */
+    int max_count;              /* Samples per packet */
+    int count;                  /* Samples collected so far */
+    int used;                   /* Payload bytes used so far */
+    unsigned long next_seq;     /* Sequence number the next sample must have */
+    unsigned long first_time;   /* Sender time of the first sample */
+};
+
+int batch_samples = 1;          /* Set with -b */
+
+/* Store a 32-bit value little-endian, whatever the host byte order */
+void put_wire_long(unsigned char *p, unsigned long value)
+{
+    p[0] = value & 0xff;
+    p[1] = (value >> 8) & 0xff;
+    p[2] = (value >> 16) & 0xff;
+    p[3] = (value >> 24) & 0xff;
+}
+
+void batch_init(struct panel_batch *batch, int state_size, long panel_type)
+{
+    init_packet_header(&batch->header, 0, panel_type);
+    batch->header.pp_byte_flags = WIRE_LONG(panel_type | PP_VERSION_2 | PP_BATCH);
+    batch->state_size = state_size;
+
+    /* As many samples as were asked for and fit in a packet */
+    batch->max_count = (PANEL_BATCH_BYTES - sizeof(struct panel_batch_header)) / (4 + state_size);
+    if (batch->max_count > batch_samples)
+        batch->max_count = batch_samples;
+    if (batch->max_count < 1)
+        batch->max_count = 1;
+
+    batch->count = 0;
+    batch->used = sizeof(struct panel_batch_header);
+}
+
+/* Send the samples collected so far; returns the panel_send() result */
+int batch_send(int sockfd, struct panel_batch *batch, int flags)
+{
+    int result;
+
+    batch->payload[0] = batch->count & 0xff;
+    batch->payload[1] = (batch->count >> 8) & 0xff;
+    batch->payload[2] = batch->state_size & 0xff;
+    batch->payload[3] = (batch->state_size >> 8) & 0xff;
+    batch->header.pp_byte_count = batch->used;
+
+    result = panel_send(sockfd, (char *)batch, sizeof(batch->header) + batch->used, flags);
+
+    batch->count = 0;
+    batch->used = sizeof(struct panel_batch_header);
+    return result;
+}
+
+/*
+ * Add a sample, sending the batch once it is full. Samples in a batch must have
+ * consecutive sequence numbers, so a gap sends what was collected first.
+ * Returns the result of the last panel_send(), or 0 if nothing was sent.
+ */
+int batch_queue(int sockfd, struct panel_batch *batch, char *state, unsigned long seq, int flags)
+{
+    unsigned long now;
+    unsigned char *p;
+    int result = 0;
+
+    if (batch->count > 0 && seq != batch->next_seq) {
+        result = batch_send(sockfd, batch, flags);
+        if (result < 0)
+            return result;
+    }
+
+    now = panel_timestamp_usec();
+    if (batch->count == 0) {
+        batch->first_time = now;
+        batch->header.pp_seq = WIRE_LONG(seq);
+        batch->header.pp_timestamp = WIRE_LONG(now);
+    }
+
+    p = batch->payload + batch->used;
+    put_wire_long(p, now - batch->first_time);
+    memcpy(p + 4, state, batch->state_size);
+    batch->used += 4 + batch->state_size;
+    batch->count++;
+    batch->next_seq = seq + 1;
+
+    if (batch->count >= batch->max_count)
+        result = batch_send(sockfd, batch, flags);
+    return result;
+}
+
+/*
+ * Send a partly filled batch once its first sample is a frame old, so samples
+ * are not held back while no new ones are queued. With send_queue > 1 the
+ * queue is flushed too, so the batch is not held back there instead. Returns
+ * the batch_send() result, or 0 if nothing was sent.
+ */
+int batch_flush_stale(int sockfd, struct panel_batch *batch, int flags)
+{
+    int result;
+
+    if (batch->count == 0 ||
+        ((panel_timestamp_usec() - batch->first_time) & 0xffffffffUL) < USEC_PER_FRAME)
+        return 0;
+
+    result = batch_send(sockfd, batch, flags);
+    if (result < 0)
+        return result;
+    return panel_flush(sockfd, flags) < 0 ? -1 : result;
+}
+
+/*
+ * Change suppression: a sample identical to the last one sent is skipped,
+ * except for a heartbeat every heartbeat_seconds, so the proxy can tell an
+ * idle machine from one that stopped sending. Clients only advance their
+ * sequence numbers for samples they send, so skipped ones are not counted
+ * as lost.
+ */
+struct panel_change {
+    char *last;                 /* Copy of the last state sent */
+    int size;                   /* Bytes per state */
+    int valid;                  /* Nonzero once last holds a state */
+    int idle;                   /* Nonzero while the state is unchanged */
+    unsigned long idle_time;    /* Sender time of the last heartbeat, or when idling started */
+};
+
+void change_init(struct panel_change *change, char *last, int size)
+{
+    change->last = last;
+    change->size = size;
+    change->valid = 0;
+    change->idle = 0;
+}
+
+/* Returns nonzero if the state has to be sent, and then remembers it as the last one sent */
+int state_changed(struct panel_change *change, char *state)
+{
+    unsigned long now;
+
+    if (heartbeat_seconds <= 0)
+        return 1;
+
+    if (!change->valid || memcmp(change->last, state, change->size) != 0) {
+        memcpy(change->last, state, change->size);
+        change->valid = 1;
+        change->idle = 0;
+        return 1;
+    }
+
+    /* The clock is only read while the state is unchanged */
+    now = panel_timestamp_usec();
+    if (!change->idle) {
+        change->idle = 1;
+        change->idle_time = now;
+        return 0;
+    }
+
+    if (((now - change->idle_time) & 0xffffffffUL) < heartbeat_seconds * 1000000UL)
+        return 0;
+
+    change->idle_time = now;
+    return 1;
+}
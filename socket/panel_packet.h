@@ -8,11 +8,43 @@
 
 #include <stdint.h>
 
+/*
+ * Protocol version, carried in the top byte of pp_byte_flags.
+ * Version 1 senders leave it 0; the panel type is in the low byte.
+ */
+#define PP_TYPE_MASK        0x000000ffUL
+#define PP_VERSION_SHIFT    24
+#define PP_VERSION_MASK     0xff000000UL
+#define PP_VERSION_2        0x02000000UL
+
+/*
+ * Version 2 flag: the payload is a panel_batch_header followed by pb_count
+ * samples, each a uint32_t offset in microseconds from pp_timestamp followed
+ * by a panel_state. Sample i has sequence number pp_seq + i.
+ */
+#define PP_BATCH            0x00000100UL
+
 /* Common packet header structure */
 #pragma pack(push, 1)
 struct panel_packet_header {
     uint16_t pp_byte_count;    /* Size of the panel_state payload */
     uint32_t pp_byte_flags;    /* Panel type flags (PANEL_PDP1170, PANEL_VAX, etc.) */
 };
+
+/* Version 2 header: the version 1 header followed by information about the sender */
+struct panel_packet_header_v2 {
+    uint16_t pp_byte_count;    /* Size of the panel_state payload */
+    uint32_t pp_byte_flags;    /* Panel type | PP_VERSION_2 */
+    uint32_t pp_seq;           /* Per-sender sequence number, incremented for every sample */
+    uint32_t pp_timestamp;     /* Sender monotonic clock when sampled, microseconds (wraps) */
+    uint32_t pp_host_id;       /* Identifies the sending host */
+    uint16_t pp_cpu;           /* CPU the state was sampled on, 0 on single-processor senders */
+};
+
+/* Payload prefix of a PP_BATCH packet */
+struct panel_batch_header {
+    uint16_t pb_count;         /* Number of samples that follow */
+    uint16_t pb_state_size;    /* Size of the panel_state in each sample */
+};
 #pragma pack(pop)
 #endif /* PANEL_PACKET_H */